@@ -0,0 +1,318 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Lexer.hpp"
+#include "Shell.hpp"
+
+#define BENCH_MEGABYTE (1024 * 1024)
+#define BENCH_DEFAULT_MAX_MEGABYTES 1024
+#define BENCH_TREE_DEPTH 512
+#define BENCH_TREE_FILES 8
+
+struct Result
+{
+  std::string name;
+  std::string unit;
+  double value;
+  size_t iterations;
+};
+
+template <typename Function>
+double nanosecondsPerIteration(size_t iterations, Function function)
+{
+  auto start = std::chrono::steady_clock::now();
+
+  for (size_t i = 0; i < iterations; i++)
+    function(i);
+
+  std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count() / iterations;
+}
+
+// Runs the benchmarks against a real Shell. Everything the shell prints goes to /dev/null; only
+// the JSON report reaches the original standard output.
+class Benchmarks
+{
+
+private:
+  Shell shell;
+  std::string workspace;
+  size_t maxBytes;
+  int reportFd;
+  std::vector<Result> results;
+
+  void record(const std::string &name, const std::string &unit, double value, size_t iterations)
+  {
+    results.push_back({name, unit, value, iterations});
+    std::cerr << name << ": " << value << ' ' << unit << '\n';
+  }
+
+  // Runs one command line through the shell, as a script line would be.
+  void run(const std::string &line)
+  {
+    shell.runCommand(line);
+  }
+
+  double secondsFor(const std::string &line)
+  {
+    auto start = std::chrono::steady_clock::now();
+    run(line);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+  }
+
+  // Text lines of random words, with "needle" on one line in ten thousand.
+  void generateFile(const std::string &path, size_t size)
+  {
+    static const char *words[] = {"alpha", "beta", "gamma", "delta", "error", "warning", "info", "debug"};
+    std::string block;
+    unsigned seed = 1;
+
+    for (size_t line = 0; block.size() < BENCH_MEGABYTE; line++)
+    {
+      for (int i = 0; i < 10; i++)
+      {
+        seed = seed * 1103515245 + 12345;
+        block += words[(seed >> 16) % 8];
+        block += ' ';
+      }
+
+      block += line % 10000 == 0 ? "needle\n" : std::to_string(line) + '\n';
+    }
+
+    block.resize(BENCH_MEGABYTE);
+    block.back() = '\n';
+
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    for (size_t written = 0; written < size; written += block.size())
+      if (write(fd, block.data(), block.size()) < 0)
+        break;
+
+    close(fd);
+  }
+
+  void benchLexer()
+  {
+    const std::vector<std::string> lines = {
+        "ls -la ~/projects",
+        "grep source.txt rosa > \"matches file.txt\"",
+        "cat /var/log/syslog | grep ERROR | grep disk &",
+        "touch < names.txt",
+        "mv \"old name.txt\" \"new name.txt\""};
+
+    Lexer lexer;
+    size_t tokens = 0;
+    size_t iterations = 1000000;
+
+    double ns = nanosecondsPerIteration(iterations, [&](size_t i)
+                                        { tokens += lexer.tokenize(lines[i % lines.size()]).size(); });
+    record("lexer.tokenize", "ns/line", ns, iterations);
+
+    ns = nanosecondsPerIteration(iterations, [&](size_t i)
+                                 { tokens += shell.getItemsName(lines[i % lines.size()]).size(); });
+    record("shell.getItemsName", "ns/line", ns, iterations);
+  }
+
+  // The registry lookup and call of a builtin that does next to nothing.
+  void benchDispatch()
+  {
+    Tokens tokens;
+    Lexer::tokenize("echo x", tokens);
+    size_t iterations = 200000;
+
+    // A first script line leaves the shell non-interactive, so builtins skip the prompt spacing.
+    run("echo x");
+
+    double ns = nanosecondsPerIteration(iterations, [&](size_t)
+                                        { shell.execute(tokens, false); });
+    record("shell.execute.dispatch", "ns/call", ns, iterations);
+  }
+
+  void benchThroughput()
+  {
+    for (size_t megabytes : {1, 64, 1024})
+    {
+      size_t size = megabytes * BENCH_MEGABYTE;
+
+      if (size > maxBytes)
+        break;
+
+      std::string path = workspace + "/data-" + std::to_string(megabytes) + "M.txt";
+      size_t iterations = std::clamp<size_t>(256 / megabytes, 1, 20);
+
+      generateFile(path, size);
+      run("cat " + path);
+
+      // cat copies into a real file: sendfile to /dev/null would not move the data at all.
+      for (const char *builtin : {"cat", "grep"})
+      {
+        std::string line = std::string(builtin) + ' ' + path + (builtin[0] == 'g' ? " needle" : " > " + workspace + "/copy");
+        double seconds = 0;
+
+        for (size_t i = 0; i < iterations; i++)
+          seconds += secondsFor(line);
+
+        record(std::string(builtin) + ".throughput." + std::to_string(megabytes) + "M", "MB/s",
+               megabytes * iterations / seconds, iterations);
+      }
+
+      unlink(path.c_str());
+      unlink((workspace + "/copy").c_str());
+    }
+  }
+
+  void benchList()
+  {
+    for (size_t entries : {10000, 100000})
+    {
+      std::string directory = workspace + "/list-" + std::to_string(entries);
+      mkdir(directory.c_str(), 0755);
+
+      for (size_t i = 0; i < entries; i++)
+        close(open((directory + "/file-" + std::to_string(i)).c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644));
+
+      size_t iterations = entries > 10000 ? 3 : 10;
+
+      for (const char *options : {"", "-l "})
+      {
+        double seconds = 0;
+        run("ls " + std::string(options) + directory);
+
+        for (size_t i = 0; i < iterations; i++)
+          seconds += secondsFor("ls " + std::string(options) + directory);
+
+        record(std::string(*options ? "ls.long." : "ls.") + std::to_string(entries), "ms/listing",
+               seconds * 1000 / iterations, iterations);
+      }
+
+      std::filesystem::remove_all(directory);
+    }
+  }
+
+  // rmdir of a chain of nested directories, each holding a few files; the tree is rebuilt untimed.
+  void benchRemove()
+  {
+    size_t iterations = 5;
+    double seconds = 0;
+
+    for (size_t i = 0; i < iterations; i++)
+    {
+      std::string root = workspace + "/tree", path = root;
+
+      for (int depth = 0; depth < BENCH_TREE_DEPTH; depth++, path += "/d")
+      {
+        mkdir(path.c_str(), 0755);
+
+        for (int file = 0; file < BENCH_TREE_FILES; file++)
+          close(open((path + "/f" + std::to_string(file)).c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644));
+      }
+
+      seconds += secondsFor("rmdir " + root);
+    }
+
+    record("rmdir.deep." + std::to_string(BENCH_TREE_DEPTH), "ms/tree", seconds * 1000 / iterations, iterations);
+  }
+
+  // A two-stage builtin pipeline, tokenized once and handed to execPipeline as runLine would.
+  void benchPipeline()
+  {
+    Tokens tokens;
+    Lexer::tokenize("echo hello | grep hello", tokens);
+    size_t iterations = 200;
+
+    shell.execPipeline(tokens);
+
+    double ns = nanosecondsPerIteration(iterations, [&](size_t)
+                                        { shell.execPipeline(tokens); });
+    record("pipeline.latency", "us/pipeline", ns / 1000, iterations);
+  }
+
+  void report()
+  {
+    FILE *out = fdopen(reportFd, "w");
+
+    // make bench passes the revision of the tree it runs from; a binary run by hand may not know it.
+    const char *revision = getenv("BENCH_REVISION");
+
+    fprintf(out, "{\n  \"revision\": \"%s\",\n  \"benchmarks\": [\n", revision ? revision : "unknown");
+
+    for (size_t i = 0; i < results.size(); i++)
+      fprintf(out, "    {\"name\": \"%s\", \"unit\": \"%s\", \"value\": %.3f, \"iterations\": %zu}%s\n",
+              results[i].name.c_str(), results[i].unit.c_str(), results[i].value, results[i].iterations,
+              i + 1 < results.size() ? "," : "");
+
+    fprintf(out, "  ]\n}\n");
+    fclose(out);
+  }
+
+public:
+  explicit Benchmarks(size_t maxMegabytes) : maxBytes(maxMegabytes * BENCH_MEGABYTE), reportFd(-1)
+  {
+    shell.setup();
+  }
+
+  int runAll()
+  {
+    char pattern[] = "/tmp/shell-bench-XXXXXX";
+
+    if (mkdtemp(pattern) == nullptr)
+    {
+      perror("mkdtemp");
+      return 1;
+    }
+
+    workspace = pattern;
+
+    // rmdir asks before removing a non-empty tree; its answers come from standard input.
+    std::string answers = workspace + "/answers";
+    int answersFd = open(answers.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    std::string yes(2 * 1024, 'y');
+
+    for (size_t i = 1; i < yes.size(); i += 2)
+      yes[i] = '\n';
+
+    if (write(answersFd, yes.data(), yes.size()) < 0)
+      perror("write");
+
+    lseek(answersFd, 0, SEEK_SET);
+    dup2(answersFd, STDIN_FILENO);
+    close(answersFd);
+
+    std::cout.flush();
+    reportFd = dup(STDOUT_FILENO);
+    int null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    dup2(null, STDOUT_FILENO);
+    close(null);
+
+    benchLexer();
+    benchDispatch();
+    benchThroughput();
+    benchList();
+    benchRemove();
+    benchPipeline();
+
+    std::cout.flush();
+    std::filesystem::remove_all(workspace);
+    report();
+
+    return 0;
+  }
+};
+
+// bench [MAX_MEGABYTES]: the largest generated file for the cat and grep runs, 1024 by default.
+int main(int argc, char *argv[])
+{
+  size_t maxMegabytes = argc > 1 ? strtoul(argv[1], nullptr, 10) : BENCH_DEFAULT_MAX_MEGABYTES;
+
+  Benchmarks benchmarks(maxMegabytes);
+  return benchmarks.runAll();
+}
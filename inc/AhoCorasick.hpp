@@ -0,0 +1,166 @@
+#ifndef __AHO_CORASICK_HPP__
+#define __AHO_CORASICK_HPP__
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#define AHO_CORASICK_NO_MATCH SIZE_MAX
+
+// Finds any of a set of literals in one pass. The automaton is a complete DFA stored as one flat
+// table, indexed by state and byte class: bytes that appear in no pattern share class 0, which
+// keeps each row short and the whole table in cache for dozens of patterns.
+class AhoCorasick
+{
+
+private:
+  std::vector<std::string> patterns;
+  std::array<uint8_t, 256> classes;
+  std::array<bool, 256> leavesRoot;
+  size_t classCount;
+  std::vector<uint32_t> transitions;
+  std::vector<size_t> outputs;
+
+  uint32_t &next(uint32_t state, uint8_t byteClass)
+  {
+    return transitions[state * classCount + byteClass];
+  }
+
+  void build()
+  {
+    const uint32_t NONE = UINT32_MAX;
+
+    classes.fill(0);
+    classCount = 1;
+
+    for (const std::string &pattern : patterns)
+      for (unsigned char c : pattern)
+        if (classes[c] == 0)
+          classes[c] = classCount++;
+
+    transitions.assign(classCount, NONE);
+    outputs.assign(1, AHO_CORASICK_NO_MATCH);
+
+    for (size_t id = 0; id < patterns.size(); id++)
+    {
+      uint32_t state = 0;
+
+      for (unsigned char c : patterns[id])
+      {
+        if (next(state, classes[c]) == NONE)
+        {
+          next(state, classes[c]) = outputs.size();
+          transitions.resize(transitions.size() + classCount, NONE);
+          outputs.push_back(AHO_CORASICK_NO_MATCH);
+        }
+
+        state = next(state, classes[c]);
+      }
+
+      if (outputs[state] == AHO_CORASICK_NO_MATCH)
+        outputs[state] = id;
+    }
+
+    // Breadth-first, so a state's failure target is complete before the state itself: every
+    // missing transition is then copied from the failure state, and every state inherits the
+    // match of its longest matching suffix.
+    std::vector<uint32_t> failure(outputs.size(), 0), queue;
+
+    for (size_t c = 0; c < classCount; c++)
+    {
+      uint32_t &target = next(0, c);
+
+      if (target == NONE)
+        target = 0;
+      else
+        queue.push_back(target);
+    }
+
+    for (size_t head = 0; head < queue.size(); head++)
+    {
+      uint32_t state = queue[head];
+
+      for (size_t c = 0; c < classCount; c++)
+      {
+        uint32_t &target = next(state, c);
+
+        if (target == NONE)
+        {
+          target = next(failure[state], c);
+          continue;
+        }
+
+        failure[target] = next(failure[state], c);
+
+        if (outputs[target] == AHO_CORASICK_NO_MATCH)
+          outputs[target] = outputs[failure[target]];
+
+        queue.push_back(target);
+      }
+    }
+
+    for (size_t c = 0; c < 256; c++)
+      leavesRoot[c] = transitions[classes[c]] != 0;
+  }
+
+public:
+  explicit AhoCorasick(const std::vector<std::string> &p) : patterns(p)
+  {
+    build();
+  }
+
+  const std::string &getPattern(size_t id) const
+  {
+    return patterns[id];
+  }
+
+  // Returns the id of the first pattern to end within [begin, end), or AHO_CORASICK_NO_MATCH;
+  // `at` receives the position where that occurrence starts.
+  size_t match(const char *begin, const char *end, const char **at = nullptr) const
+  {
+    if (outputs[0] != AHO_CORASICK_NO_MATCH)
+    {
+      if (at)
+        *at = begin;
+      return outputs[0];
+    }
+
+    const uint32_t *table = transitions.data();
+    uint32_t state = 0;
+
+    for (const char *p = begin; p < end; p++)
+    {
+      unsigned char c = *p;
+
+      if (state == 0)
+      {
+        while (!leavesRoot[c] and ++p < end)
+          c = *p;
+
+        if (p == end)
+          break;
+      }
+
+      state = table[state * classCount + classes[c]];
+
+      if (outputs[state] != AHO_CORASICK_NO_MATCH)
+      {
+        if (at)
+          *at = p + 1 - patterns[outputs[state]].size();
+        return outputs[state];
+      }
+    }
+
+    return AHO_CORASICK_NO_MATCH;
+  }
+
+  const char *find(const char *begin, const char *end) const
+  {
+    const char *at = nullptr;
+    return match(begin, end, &at) == AHO_CORASICK_NO_MATCH ? nullptr : at;
+  }
+};
+
+#endif
@@ -0,0 +1,238 @@
+#ifndef __BATCH_HPP__
+#define __BATCH_HPP__
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include "ThreadPool.hpp"
+#include "Uring.hpp"
+
+#define BATCH_RING_ENTRIES 1024
+#define BATCH_MIN_SIZE 256
+#define BATCH_CHUNK_SIZE 512
+#define BATCH_OPEN_LIMIT 256
+#define BATCH_WORKERS_PER_THREAD 8
+#define BATCH_CLOSE_BIT (1ULL << 63)
+#define BATCH_UNRESOLVED -1
+
+enum BatchOperation
+{
+  BATCH_CREATE,
+  BATCH_UNLINK
+};
+
+struct BatchResult
+{
+  int error;
+  bool closing;
+};
+
+// Runs one metadata operation over a list of paths: creating empty files or unlinking files. Long
+// lists go through an io_uring, keeping as many requests in flight as its completion ring holds; a
+// created file's close is queued as soon as its open completes. Without io_uring the list is cut
+// into chunks of plain system calls run on the pool. With a single CPU neither can overlap
+// anything, and the calls are made in place.
+class MetadataBatch
+{
+
+private:
+  ThreadPool &pool;
+  BatchOperation operation;
+  mode_t mode;
+
+  BatchResult apply(const std::string &path) const
+  {
+    switch (operation)
+    {
+    case BATCH_CREATE:
+    {
+      int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, mode);
+
+      if (fd < 0)
+        return {errno, false};
+
+      if (close(fd) < 0)
+        return {errno, true};
+
+      return {0, false};
+    }
+
+    default:
+      return {unlink(path.c_str()) < 0 ? errno : 0, false};
+    }
+  }
+
+  void prepare(struct io_uring_sqe *entry, const std::string &path, size_t index) const
+  {
+    entry->fd = AT_FDCWD;
+    entry->addr = reinterpret_cast<uint64_t>(path.c_str());
+    entry->user_data = index;
+
+    switch (operation)
+    {
+    case BATCH_CREATE:
+      entry->opcode = IORING_OP_OPENAT;
+      entry->len = mode;
+      entry->open_flags = O_WRONLY | O_CREAT | O_CLOEXEC;
+      break;
+
+    case BATCH_UNLINK:
+      entry->opcode = IORING_OP_UNLINKAT;
+      break;
+    }
+  }
+
+  // Returns false, with nothing done, when the kernel offers no ring or lacks one of the opcodes.
+  bool runRing(const std::vector<std::string> &paths, std::vector<BatchResult> &results)
+  {
+    static const uint8_t opcodes[] = {IORING_OP_OPENAT, IORING_OP_UNLINKAT};
+    Uring ring(BATCH_RING_ENTRIES);
+
+    if (!ring.isReady() or !ring.supports(opcodes[operation]) or
+        (operation == BATCH_CREATE and !ring.supports(IORING_OP_CLOSE)))
+      return false;
+
+    // Every one of these requests blocks in the kernel: left alone, it would start a thread for each.
+    ring.limitWorkers(pool.size() * BATCH_WORKERS_PER_THREAD);
+
+    // An open is only sent with room left for the completion of its close, and with few enough
+    // files open that the descriptor limit is never reached.
+    struct rlimit files;
+    size_t openLimit = BATCH_OPEN_LIMIT;
+
+    if (getrlimit(RLIMIT_NOFILE, &files) == 0)
+      openLimit = std::clamp<size_t>(files.rlim_cur / 4, 1, BATCH_OPEN_LIMIT);
+
+    unsigned cost = operation == BATCH_CREATE ? 2 : 1;
+    unsigned reserved = 0, outstanding = 0;
+    size_t next = 0, done = 0;
+    std::vector<std::pair<size_t, int>> closes;
+
+    auto complete = [&](uint64_t data, int32_t result)
+    {
+      size_t index = data & ~BATCH_CLOSE_BIT;
+      outstanding--;
+
+      if (data & BATCH_CLOSE_BIT)
+      {
+        results[index] = {result < 0 ? -result : 0, result < 0};
+        reserved -= 1;
+        done++;
+      }
+      else if (result >= 0 and operation == BATCH_CREATE)
+      {
+        closes.push_back({index, result});
+        reserved -= 1;
+      }
+      else
+      {
+        results[index] = {result < 0 ? -result : 0, false};
+        reserved -= cost;
+        done++;
+      }
+    };
+
+    while (done < paths.size())
+    {
+      struct io_uring_sqe *entry;
+
+      while (!closes.empty() and (entry = ring.next()) != nullptr)
+      {
+        entry->opcode = IORING_OP_CLOSE;
+        entry->fd = closes.back().second;
+        entry->user_data = closes.back().first | BATCH_CLOSE_BIT;
+        closes.pop_back();
+        outstanding++;
+      }
+
+      while (next < paths.size() and reserved + cost <= ring.capacity() and
+             (operation != BATCH_CREATE or next - done < openLimit) and (entry = ring.next()) != nullptr)
+      {
+        prepare(entry, paths[next], next);
+        reserved += cost;
+        outstanding++;
+        next++;
+      }
+
+      // Waiting for half of what is in flight lets the kernel's workers run through a long stretch
+      // of requests before the submitter wakes up again.
+      int status = ring.submit(std::max(outstanding / 2, 1u));
+
+      if (status != 0)
+      {
+        // Entries the kernel never took are done in place. Requests it did take are waited for,
+        // so that every descriptor an open hands back is closed. Only one whose completion never
+        // arrives gets the ring's error; the rest of the list is still done, one call at a time.
+        ring.withdraw([&](const struct io_uring_sqe &entry)
+                      {
+                        size_t index = entry.user_data & ~BATCH_CLOSE_BIT;
+                        outstanding--;
+
+                        if (entry.user_data & BATCH_CLOSE_BIT)
+                          closes.push_back({index, entry.fd});
+                        else
+                          results[index] = apply(paths[index]); });
+
+        ring.reap(complete);
+
+        while (outstanding > 0 and ring.submit(1) == 0)
+          ring.reap(complete);
+
+        for (auto [index, fd] : closes)
+          results[index] = {close(fd) < 0 ? errno : 0, true};
+
+        for (size_t i = 0; i < paths.size(); i++)
+          if (results[i].error == BATCH_UNRESOLVED)
+            results[i] = i < next ? BatchResult{status, false} : apply(paths[i]);
+
+        return true;
+      }
+
+      ring.reap(complete);
+    }
+
+    return true;
+  }
+
+public:
+  MetadataBatch(ThreadPool &p, BatchOperation op, mode_t m = 0) : pool(p), operation(op), mode(m) {}
+
+  // Fills `results` with each path's outcome, in the list's order.
+  void run(const std::vector<std::string> &paths, std::vector<BatchResult> &results)
+  {
+    results.assign(paths.size(), {BATCH_UNRESOLVED, false});
+
+    if (paths.size() < BATCH_MIN_SIZE or pool.size() < 2)
+    {
+      for (size_t i = 0; i < paths.size(); i++)
+        results[i] = apply(paths[i]);
+
+      return;
+    }
+
+    if (runRing(paths, results))
+      return;
+
+    for (size_t begin = 0; begin < paths.size(); begin += BATCH_CHUNK_SIZE)
+    {
+      size_t end = std::min(begin + BATCH_CHUNK_SIZE, paths.size());
+
+      pool.submit([this, &paths, &results, begin, end]
+                  {
+                    for (size_t i = begin; i < end; i++)
+                      results[i] = apply(paths[i]); });
+    }
+
+    pool.wait();
+  }
+};
+
+#endif
@@ -0,0 +1,175 @@
+#ifndef __COMPLETION_HPP__
+#define __COMPLETION_HPP__
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "EntryCache.hpp"
+#include "Process.hpp"
+#include "Utils.hpp"
+
+#define COMPLETION_SHOWN_LIMIT 100
+
+struct Completion
+{
+  std::string name;
+  bool directory;
+};
+
+// What matches a word: how many candidates, the longest prefix they share and the first few of
+// them, in order. A sorted range is described by its ends, so a prefix matching half a huge
+// directory costs no more than one matching a single file.
+struct Completions
+{
+  size_t count;
+  std::string common;
+  std::vector<Completion> shown;
+
+  void clear()
+  {
+    count = 0;
+    common.clear();
+    shown.clear();
+  }
+};
+
+inline size_t commonPrefixLength(std::string_view a, std::string_view b)
+{
+  size_t length = 0;
+
+  while (length < a.size() and length < b.size() and a[length] == b[length])
+    length++;
+
+  return length;
+}
+
+// Candidates for the word being typed: builtins and $PATH executables in command position, paths
+// anywhere else. Directory entries come sorted from the cache, so the candidates for a prefix are
+// a binary search away and the prefix they share comes from the ends of the range: on a directory
+// of hundreds of thousands of entries, every key after the first costs a stat.
+class Completer
+{
+
+private:
+  std::vector<std::string> commands;
+  PathIndex &executables;
+  EntryCache &directories;
+
+  static bool isDirectory(const std::string &path, const DirectoryEntries &entries, size_t i)
+  {
+    // Links, and file systems that do not fill d_type, are only looked at when they are shown.
+    if (entries.types[i] != DT_LNK and entries.types[i] != DT_UNKNOWN)
+      return entries.types[i] == DT_DIR;
+
+    struct stat st;
+    return stat((path + "/" + entries.name(i)).c_str(), &st) == 0 and S_ISDIR(st.st_mode);
+  }
+
+  // The entries of `path` whose names start with `prefix`. Hidden entries only come with a prefix
+  // that starts with a dot.
+  void completePath(const std::string &path, std::string_view prefix, Completions &result)
+  {
+    int error;
+    auto entries = directories.get(path, error);
+
+    if (!entries)
+      return;
+
+    auto startsWith = [&entries](size_t i, std::string_view prefix)
+    { return std::string_view(entries->name(i)).compare(0, prefix.size(), prefix); };
+    auto firstFrom = [&](size_t from, std::string_view prefix, bool past)
+    {
+      size_t low = from, high = entries->size();
+
+      while (low < high)
+      {
+        size_t middle = low + (high - low) / 2;
+        int order = startsWith(middle, prefix);
+
+        if (order < 0 or (past and order == 0))
+          low = middle + 1;
+        else
+          high = middle;
+      }
+
+      return low;
+    };
+
+    size_t first = firstFrom(0, prefix, false);
+    size_t last = firstFrom(first, prefix, true);
+
+    // Without a dot to start the prefix, the hidden names are one block inside the range.
+    size_t hiddenFirst = last, hiddenLast = last;
+
+    if (prefix.empty())
+    {
+      hiddenFirst = firstFrom(0, ".", false);
+      hiddenLast = firstFrom(hiddenFirst, ".", true);
+    }
+
+    result.count = (last - first) - (hiddenLast - hiddenFirst);
+
+    if (result.count == 0)
+      return;
+
+    size_t lowest = first == hiddenFirst ? hiddenLast : first;
+    size_t highest = hiddenLast == last ? hiddenFirst : last;
+    std::string_view low = entries->name(lowest), high = entries->name(highest - 1);
+    result.common = low.substr(0, commonPrefixLength(low, high));
+
+    for (size_t i = first; i < last and result.shown.size() < COMPLETION_SHOWN_LIMIT; i++)
+      if (i < hiddenFirst or i >= hiddenLast)
+        result.shown.push_back({entries->name(i), isDirectory(path, *entries, i)});
+  }
+
+public:
+  Completer(std::vector<std::string> builtins, PathIndex &paths, EntryCache &cache)
+      : commands(std::move(builtins)), executables(paths), directories(cache)
+  {
+    std::sort(commands.begin(), commands.end());
+  }
+
+  // Fills `result` for `word`; `replaced` is how many characters at its end the candidates
+  // replace: the part after the last slash for a path, the whole word for a command.
+  void complete(const std::string &word, bool commandPosition, Completions &result, size_t &replaced)
+  {
+    result.clear();
+
+    if (commandPosition and word.find('/') == std::string::npos)
+    {
+      std::vector<std::string> names;
+
+      for (auto name = std::lower_bound(commands.begin(), commands.end(), word);
+           name != commands.end() and name->compare(0, word.size(), word) == 0; name++)
+        names.push_back(*name);
+
+      executables.complete(word, names);
+      std::sort(names.begin(), names.end());
+      names.erase(std::unique(names.begin(), names.end()), names.end());
+
+      result.count = names.size();
+
+      if (!names.empty())
+        result.common = names[0].substr(0, commonPrefixLength(names.front(), names.back()));
+
+      for (size_t i = 0; i < names.size() and i < COMPLETION_SHOWN_LIMIT; i++)
+        result.shown.push_back({std::move(names[i]), false});
+
+      replaced = word.size();
+      return;
+    }
+
+    size_t slash = word.find_last_of('/');
+    std::string directory = slash == std::string::npos ? "." : word.substr(0, slash + 1);
+    std::string prefix = slash == std::string::npos ? word : word.substr(slash + 1);
+
+    completePath(expandHome(directory), prefix, result);
+    replaced = prefix.size();
+  }
+};
+
+#endif
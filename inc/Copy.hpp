@@ -0,0 +1,312 @@
+#ifndef __COPY_HPP__
+#define __COPY_HPP__
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "ThreadPool.hpp"
+#include "Transfer.hpp"
+
+struct CopyProgress
+{
+  size_t files;
+  size_t directories;
+  size_t bytes;
+  double seconds;
+};
+
+// Copies files and directory trees relative to open directory descriptors, like TreeRemover. Each
+// directory is read by one task and each file in it is copied by a task of its own, so large trees
+// copy in parallel across files; a directory is opened only once its task runs, so queued ones hold
+// no descriptors. Symbolic links are copied as links and other special files are recreated as new
+// nodes; neither is ever opened.
+class TreeCopier
+{
+
+private:
+  struct Node
+  {
+    Node *parent;
+    std::string sourceName;
+    std::string targetName;
+    int sourceFd;
+    int targetFd;
+    mode_t mode;
+    bool created;
+    struct timespec times[2];
+    std::atomic<size_t> pending;
+  };
+
+  ThreadPool &pool;
+  bool keepTimes;
+  std::atomic<size_t> files;
+  std::atomic<size_t> directories;
+  std::atomic<size_t> bytes;
+  std::atomic<int> error;
+
+  void fail(int code = errno)
+  {
+    int expected = 0;
+    error.compare_exchange_strong(expected, code);
+  }
+
+  // Directories are created writable and given their own mode, and their times, once everything
+  // inside is copied. One that already existed keeps its own.
+  void release(Node *node)
+  {
+    while (node->parent and --node->pending == 0)
+    {
+      Node *parent = node->parent;
+
+      if (node->targetFd >= 0)
+      {
+        if (node->created)
+        {
+          fchmod(node->targetFd, node->mode);
+
+          if (keepTimes)
+            futimens(node->targetFd, node->times);
+        }
+
+        close(node->targetFd);
+      }
+
+      if (node->sourceFd >= 0)
+        close(node->sourceFd);
+
+      delete node;
+      node = parent;
+    }
+  }
+
+  bool copyFile(int sourceDir, const char *sourceName, int targetDir, const char *targetName)
+  {
+    // Non-blocking, so that a source swapped for a FIFO since it was listed cannot hang the open.
+    int in = openat(sourceDir, sourceName, O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+    struct stat st;
+    bool opened = in >= 0 and fstat(in, &st) == 0;
+
+    if (!opened or !S_ISREG(st.st_mode))
+    {
+      fail(opened ? EINVAL : errno);
+
+      if (in >= 0)
+        close(in);
+      return false;
+    }
+
+    int out = openat(targetDir, targetName, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 07777);
+    bool copied = out >= 0 and copyFileContents(in, out);
+
+    if (copied and keepTimes)
+    {
+      const struct timespec times[] = {st.st_atim, st.st_mtim};
+      futimens(out, times);
+    }
+
+    if (!copied)
+      fail();
+    else
+    {
+      files++;
+      bytes += st.st_size;
+    }
+
+    if (out >= 0)
+      close(out);
+    close(in);
+
+    return copied;
+  }
+
+  void copyLink(int sourceDir, const char *sourceName, int targetDir, const char *targetName, const struct stat &st)
+  {
+    char link[PATH_MAX];
+    ssize_t length = readlinkat(sourceDir, sourceName, link, sizeof(link) - 1);
+
+    if (length < 0)
+      return fail();
+
+    link[length] = '\0';
+
+    if (symlinkat(link, targetDir, targetName) < 0)
+      return fail();
+
+    files++;
+
+    if (keepTimes)
+    {
+      const struct timespec times[] = {st.st_atim, st.st_mtim};
+      utimensat(targetDir, targetName, times, AT_SYMLINK_NOFOLLOW);
+    }
+  }
+
+  // FIFOs, sockets and devices are made anew from the source's type, mode and device number:
+  // opening them would block on a FIFO or read from the device itself.
+  void copyNode(int targetDir, const char *targetName, const struct stat &st)
+  {
+    if (mknodat(targetDir, targetName, st.st_mode & (S_IFMT | 07777), st.st_rdev) < 0)
+      return fail();
+
+    files++;
+
+    if (keepTimes)
+    {
+      const struct timespec times[] = {st.st_atim, st.st_mtim};
+      utimensat(targetDir, targetName, times, 0);
+    }
+  }
+
+  // Creates the target directory under `parent` and schedules the copy of the source's contents.
+  void descend(Node *parent, const char *sourceName, const char *targetName, const struct stat &st)
+  {
+    mode_t mode = st.st_mode & 07777;
+
+    bool created = mkdirat(parent->targetFd, targetName, mode | S_IRWXU) == 0;
+
+    if (!created and errno != EEXIST)
+      return fail();
+
+    directories++;
+
+    Node *child = new Node{parent, sourceName, targetName, -1, -1, mode, created, {st.st_atim, st.st_mtim}, {1}};
+    parent->pending++;
+    pool.submit([this, child]
+                { scan(child); });
+  }
+
+  void scan(Node *node)
+  {
+    node->sourceFd = openat(node->parent->sourceFd, node->sourceName.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    node->targetFd = openat(node->parent->targetFd, node->targetName.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+
+    int fd = node->sourceFd < 0 or node->targetFd < 0 ? -1 : dup(node->sourceFd);
+    DIR *dir = fd < 0 ? nullptr : fdopendir(fd);
+
+    if (dir == nullptr)
+    {
+      if (fd >= 0)
+        close(fd);
+      fail();
+      release(node);
+      return;
+    }
+
+    dirent *d;
+
+    while ((d = readdir(dir)) != nullptr)
+    {
+      if (!strcmp(d->d_name, ".") or !strcmp(d->d_name, ".."))
+        continue;
+
+      struct stat st;
+
+      if (fstatat(node->sourceFd, d->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+      {
+        fail();
+        continue;
+      }
+
+      if (S_ISDIR(st.st_mode))
+        descend(node, d->d_name, d->d_name, st);
+      else if (S_ISLNK(st.st_mode))
+        copyLink(node->sourceFd, d->d_name, node->targetFd, d->d_name, st);
+      else if (S_ISREG(st.st_mode))
+      {
+        std::string name = d->d_name;
+        node->pending++;
+        pool.submit([this, node, name]
+                    {
+                      copyFile(node->sourceFd, name.c_str(), node->targetFd, name.c_str());
+                      release(node); });
+      }
+      else
+        copyNode(node->targetFd, d->d_name, st);
+    }
+
+    closedir(dir);
+    release(node);
+  }
+
+  static void split(const std::string &path, std::string &parent, std::string &name)
+  {
+    parent = ".";
+    name = path;
+
+    while (name.size() > 1 and name.back() == '/')
+      name.pop_back();
+
+    size_t slash = name.find_last_of('/');
+
+    if (slash != std::string::npos)
+    {
+      parent = slash == 0 ? "/" : name.substr(0, slash);
+      name = name.substr(slash + 1);
+    }
+  }
+
+public:
+  // With `preserveTimes` the copies keep the access and modification times of their sources.
+  explicit TreeCopier(ThreadPool &p, bool preserveTimes = false)
+      : pool(p), keepTimes(preserveTimes), files(0), directories(0), bytes(0), error(0) {}
+
+  // Copies `source`, a file or a whole directory, to the new path `target`. Returns 0 or the first
+  // errno met; EINVAL when the target lies inside the source directory.
+  int copy(const std::string &source, const std::string &target, CopyProgress &progress)
+  {
+    auto start = std::chrono::steady_clock::now();
+    struct stat st;
+
+    if (lstat(source.c_str(), &st) < 0)
+      return errno;
+
+    std::string sourceParent, sourceName, targetParent, targetName;
+    split(source, sourceParent, sourceName);
+    split(target, targetParent, targetName);
+
+    Node root{nullptr, sourceParent, targetParent, open(sourceParent.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC),
+              open(targetParent.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC), 0, false, {}, {1}};
+
+    if (root.sourceFd < 0 or root.targetFd < 0)
+      fail();
+    else if (S_ISDIR(st.st_mode))
+    {
+      char sourceReal[PATH_MAX], targetReal[PATH_MAX];
+
+      if (realpath(source.c_str(), sourceReal) and realpath(targetParent.c_str(), targetReal) and
+          (std::string(targetReal) + "/").rfind(std::string(sourceReal) + "/", 0) == 0)
+        fail(EINVAL);
+      else
+        descend(&root, sourceName.c_str(), targetName.c_str(), st);
+    }
+    else if (S_ISLNK(st.st_mode))
+      copyLink(root.sourceFd, sourceName.c_str(), root.targetFd, targetName.c_str(), st);
+    else if (S_ISREG(st.st_mode))
+      copyFile(root.sourceFd, sourceName.c_str(), root.targetFd, targetName.c_str());
+    else
+      copyNode(root.targetFd, targetName.c_str(), st);
+
+    pool.wait();
+
+    if (root.sourceFd >= 0)
+      close(root.sourceFd);
+    if (root.targetFd >= 0)
+      close(root.targetFd);
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    progress = {files.load(), directories.load(), bytes.load(), elapsed.count()};
+
+    return error.load();
+  }
+};
+
+#endif
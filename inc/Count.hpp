@@ -0,0 +1,297 @@
+#ifndef __COUNT_HPP__
+#define __COUNT_HPP__
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define COUNT_X86
+#endif
+
+#define COUNT_BLOCK_SIZE (1 << 20)
+// A byte lane counts at most this many matches before it is summed into the 64-bit totals.
+#define COUNT_LANE_LIMIT 255
+
+struct Counts
+{
+  uint64_t lines;
+  uint64_t words;
+  uint64_t bytes;
+};
+
+// Words are counted as GNU wc counts them in the C locale: printable bytes make words, blanks
+// (space, \t, \n, \v, \f and \r) end them, and any other byte does neither. A word is counted at
+// its first printable byte, so `inWord` carries the state over from the previous block.
+inline bool isBlank(unsigned char c)
+{
+  return c == ' ' or (c >= '\t' and c <= '\r');
+}
+
+inline void scalarCount(const char *data, size_t size, Counts &counts, bool &inWord, bool words)
+{
+  uint64_t lines = 0, starts = 0;
+
+  for (size_t i = 0; i < size; i++)
+  {
+    unsigned char c = data[i];
+    lines += c == '\n';
+
+    if (!words)
+      continue;
+
+    if (isBlank(c))
+      inWord = false;
+    else if (c > ' ' and c < 0x7F)
+    {
+      starts += !inWord;
+      inWord = true;
+    }
+  }
+
+  counts.lines += lines;
+  counts.words += starts;
+}
+
+// The state before each byte of a vector, from its masks of printable and of neutral bytes: a
+// printable byte sets it, a blank clears it and a neutral one passes it on. That is a carry chain,
+// with printable bytes generating and neutral ones propagating, so one addition resolves it; the
+// carry out of the top is the state after the vector.
+inline uint64_t wordStates(uint64_t printable, uint64_t neutral, uint64_t state)
+{
+  uint64_t through = printable | neutral;
+  return (printable + through + state) ^ printable ^ through;
+}
+
+#ifdef COUNT_X86
+
+// Lines only: each comparison subtracts -1 from a byte lane wherever a newline is, and the lanes
+// are summed with psadbw before any of them can overflow.
+inline uint64_t sse2Lines(const char *data, size_t size, size_t &done)
+{
+  const __m128i newline = _mm_set1_epi8('\n');
+  const __m128i zero = _mm_setzero_si128();
+  __m128i total = zero;
+  size_t i = 0;
+
+  while (size - i >= 16)
+  {
+    size_t rounds = std::min<size_t>((size - i) / 16, COUNT_LANE_LIMIT);
+    __m128i lanes = zero;
+
+    for (size_t r = 0; r < rounds; r++, i += 16)
+      lanes = _mm_sub_epi8(lanes, _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i)), newline));
+
+    total = _mm_add_epi64(total, _mm_sad_epu8(lanes, zero));
+  }
+
+  done = i;
+  return _mm_cvtsi128_si64(total) + _mm_cvtsi128_si64(_mm_unpackhi_epi64(total, total));
+}
+
+// Blanks are ' ' and the bytes 9 to 13; the second test is one unsigned comparison, b - 9 <= 4.
+inline __m128i sse2Blanks(__m128i block)
+{
+  const __m128i shifted = _mm_sub_epi8(block, _mm_set1_epi8('\t'));
+  const __m128i control = _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8('\r' - '\t')), shifted);
+
+  return _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8(' ')), control);
+}
+
+inline void sse2Count(const char *data, size_t size, Counts &counts, bool &inWord, bool words)
+{
+  size_t done = 0;
+
+  if (!words)
+  {
+    counts.lines += sse2Lines(data, size, done);
+    scalarCount(data + done, size - done, counts, inWord, false);
+    return;
+  }
+
+  const __m128i newline = _mm_set1_epi8('\n');
+  const __m128i space = _mm_set1_epi8(' ');
+  const __m128i deleted = _mm_set1_epi8(0x7F);
+  uint64_t lines = 0, starts = 0, state = inWord;
+
+  for (; size - done >= 16; done += 16)
+  {
+    const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + done));
+    const __m128i printable = _mm_and_si128(_mm_cmpgt_epi8(block, space), _mm_cmpgt_epi8(deleted, block));
+    uint64_t visible = _mm_movemask_epi8(printable);
+    uint64_t neutral = ~(visible | _mm_movemask_epi8(sse2Blanks(block))) & 0xFFFF;
+    uint64_t carries = wordStates(visible, neutral, state);
+
+    starts += __builtin_popcountll(visible & ~carries);
+    lines += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(block, newline)));
+    state = carries >> 16 & 1;
+  }
+
+  inWord = state;
+  counts.lines += lines;
+  counts.words += starts;
+  scalarCount(data + done, size - done, counts, inWord, true);
+}
+
+__attribute__((target("avx2"))) inline uint64_t avx2Lines(const char *data, size_t size, size_t &done)
+{
+  const __m256i newline = _mm256_set1_epi8('\n');
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i total = zero;
+  size_t i = 0;
+
+  while (size - i >= 32)
+  {
+    size_t rounds = std::min<size_t>((size - i) / 32, COUNT_LANE_LIMIT);
+    __m256i lanes = zero;
+
+    for (size_t r = 0; r < rounds; r++, i += 32)
+      lanes = _mm256_sub_epi8(lanes, _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i)), newline));
+
+    total = _mm256_add_epi64(total, _mm256_sad_epu8(lanes, zero));
+  }
+
+  done = i;
+  return _mm256_extract_epi64(total, 0) + _mm256_extract_epi64(total, 1) + _mm256_extract_epi64(total, 2) +
+         _mm256_extract_epi64(total, 3);
+}
+
+__attribute__((target("avx2,popcnt"))) inline void avx2Count(const char *data, size_t size, Counts &counts, bool &inWord, bool words)
+{
+  size_t done = 0;
+
+  if (!words)
+  {
+    counts.lines += avx2Lines(data, size, done);
+    sse2Count(data + done, size - done, counts, inWord, false);
+    return;
+  }
+
+  const __m256i newline = _mm256_set1_epi8('\n');
+  const __m256i space = _mm256_set1_epi8(' ');
+  const __m256i tab = _mm256_set1_epi8('\t');
+  const __m256i range = _mm256_set1_epi8('\r' - '\t');
+  const __m256i deleted = _mm256_set1_epi8(0x7F);
+  uint64_t lines = 0, starts = 0, state = inWord;
+
+  for (; size - done >= 32; done += 32)
+  {
+    const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + done));
+    const __m256i shifted = _mm256_sub_epi8(block, tab);
+    const __m256i blanks = _mm256_or_si256(_mm256_cmpeq_epi8(block, space),
+                                           _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, range), shifted));
+    const __m256i printable = _mm256_and_si256(_mm256_cmpgt_epi8(block, space), _mm256_cmpgt_epi8(deleted, block));
+    uint64_t visible = static_cast<uint32_t>(_mm256_movemask_epi8(printable));
+    uint64_t neutral = ~(visible | static_cast<uint32_t>(_mm256_movemask_epi8(blanks))) & 0xFFFFFFFF;
+    uint64_t carries = wordStates(visible, neutral, state);
+
+    starts += _mm_popcnt_u64(visible & ~carries);
+    lines += _mm_popcnt_u32(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, newline)));
+    state = carries >> 32 & 1;
+  }
+
+  inWord = state;
+  counts.lines += lines;
+  counts.words += starts;
+  sse2Count(data + done, size - done, counts, inWord, true);
+}
+
+#endif
+
+// Counts lines, words and bytes over a stream handed over in blocks of any size. Lines are
+// newlines, as wc counts them; skipping words leaves a loop with one comparison per vector.
+class Counter
+{
+
+private:
+  void (*kernel)(const char *, size_t, Counts &, bool &, bool);
+  bool words;
+  bool inWord = false;
+  Counts counts = {0, 0, 0};
+
+public:
+  explicit Counter(bool countWords) : kernel(scalarCount), words(countWords)
+  {
+#ifdef COUNT_X86
+    kernel = __builtin_cpu_supports("avx2") ? avx2Count : sse2Count;
+#endif
+  }
+
+  void add(const char *data, size_t size)
+  {
+    kernel(data, size, counts, inWord, words);
+    counts.bytes += size;
+  }
+
+  const Counts &result() const
+  {
+    return counts;
+  }
+
+  // Feeds everything `read(buffer, size)` returns until it returns 0. Returns false on a read error.
+  template <typename Reader>
+  bool addAll(Reader read)
+  {
+    std::unique_ptr<char[]> buffer(new char[COUNT_BLOCK_SIZE]);
+
+    while (true)
+    {
+      ssize_t length = read(buffer.get(), COUNT_BLOCK_SIZE);
+
+      if (length < 0 and errno == EINTR)
+        continue;
+
+      if (length <= 0)
+        return length == 0;
+
+      add(buffer.get(), length);
+    }
+  }
+};
+
+// Counts one file. The size of a regular file is its byte count, so counting bytes alone reads
+// nothing. Returns 0 or the errno that stopped the count.
+inline int countFile(const std::string &path, bool lines, bool words, Counts &counts)
+{
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+  if (fd < 0)
+    return errno;
+
+  struct stat st = {};
+
+  if (fstat(fd, &st) < 0 or S_ISDIR(st.st_mode))
+  {
+    int error = S_ISDIR(st.st_mode) ? EISDIR : errno;
+    close(fd);
+    return error;
+  }
+
+  if (!lines and !words and S_ISREG(st.st_mode))
+  {
+    counts = {0, 0, static_cast<uint64_t>(st.st_size)};
+    close(fd);
+    return 0;
+  }
+
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  Counter counter(words);
+  bool readOk = counter.addAll([fd](char *buffer, size_t size)
+                               { return ::read(fd, buffer, size); });
+  int error = readOk ? 0 : errno;
+
+  counts = counter.result();
+  close(fd);
+
+  return error;
+}
+
+#endif
@@ -0,0 +1,302 @@
+#ifndef __ENTRY_CACHE_HPP__
+#define __ENTRY_CACHE_HPP__
+
+#include <atomic>
+#include <cerrno>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include "Listing.hpp"
+
+#define ENTRY_CACHE_SIZE 64
+#define ENTRY_CACHE_BYTE_LIMIT (64 * 1024 * 1024)
+#define ENTRY_CACHE_EVENT_BUFFER (64 * 1024)
+#define ENTRY_CACHE_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+struct EntryCacheStats
+{
+  size_t directories;
+  size_t bytes;
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t invalidations;
+};
+
+// The sorted entries of recently read directories, shared by ls, completion and rmdir. A directory is
+// known by its device and inode, so every path that leads to it finds the same entry, and each one is
+// watched with inotify: a name created, removed or renamed in it drops the entry before the next
+// lookup. The mtime is compared as well, for file systems whose changes inotify never sees, such as
+// one mounted over the network. Readers get a snapshot that stays valid while they hold it.
+class EntryCache
+{
+
+private:
+  using Key = std::pair<dev_t, ino_t>;
+
+  struct Directory
+  {
+    int watch;
+    struct timespec mtime;
+    std::shared_ptr<const DirectoryEntries> entries;
+    std::list<Key>::iterator use;
+  };
+
+  int notify;
+  pid_t owner;
+  std::mutex mutex;
+  std::map<Key, Directory> directories;
+  std::unordered_map<int, Key> watches;
+  std::list<Key> recent;
+  size_t bytes = 0;
+
+  std::atomic<uint64_t> hits{0};
+  std::atomic<uint64_t> misses{0};
+  std::atomic<uint64_t> invalidations{0};
+
+  // A forked child shares the inotify descriptor, and reading from it would take events away from
+  // the shell; it goes without the cache instead.
+  bool usable() const
+  {
+    return notify >= 0 and owner == getpid();
+  }
+
+  void drop(std::map<Key, Directory>::iterator directory, bool unwatch)
+  {
+    if (unwatch)
+      inotify_rm_watch(notify, directory->second.watch);
+
+    watches.erase(directory->second.watch);
+    bytes -= directory->second.entries ? directory->second.entries->names.size() : 0;
+    recent.erase(directory->second.use);
+    directories.erase(directory);
+  }
+
+  void invalidate(std::map<Key, Directory>::iterator directory)
+  {
+    if (!directory->second.entries)
+      return;
+
+    bytes -= directory->second.entries->names.size();
+    directory->second.entries.reset();
+    invalidations++;
+  }
+
+  // Applies the events queued since the last lookup.
+  void drain()
+  {
+    alignas(struct inotify_event) char buffer[ENTRY_CACHE_EVENT_BUFFER];
+    ssize_t count;
+
+    while ((count = ::read(notify, buffer, sizeof(buffer))) > 0)
+      for (char *at = buffer; at < buffer + count;)
+      {
+        const struct inotify_event *event = reinterpret_cast<const struct inotify_event *>(at);
+        at += sizeof(struct inotify_event) + event->len;
+
+        if (event->mask & IN_Q_OVERFLOW)
+        {
+          for (auto directory = directories.begin(); directory != directories.end(); directory++)
+            invalidate(directory);
+
+          continue;
+        }
+
+        auto watch = watches.find(event->wd);
+
+        if (watch == watches.end())
+          continue;
+
+        auto directory = directories.find(watch->second);
+
+        if (event->mask & IN_IGNORED)
+          drop(directory, false);
+        else
+          invalidate(directory);
+      }
+  }
+
+  void trim()
+  {
+    while (!recent.empty() and (directories.size() > ENTRY_CACHE_SIZE or bytes > ENTRY_CACHE_BYTE_LIMIT))
+      drop(directories.find(recent.back()), true);
+  }
+
+  // One getdents64 buffer per thread, for the reads that miss.
+  static DirectoryStream &stream()
+  {
+    static thread_local DirectoryStream stream;
+    return stream;
+  }
+
+  static std::shared_ptr<const DirectoryEntries> read(const std::string &path, int &error)
+  {
+    DirectoryStream &stream = EntryCache::stream();
+    auto entries = std::make_shared<DirectoryEntries>();
+
+    if (!stream.open(path))
+    {
+      error = errno;
+      return nullptr;
+    }
+
+    error = entries->read(stream);
+    stream.close();
+
+    return error == 0 ? std::move(entries) : nullptr;
+  }
+
+  // A valid cached copy for the directory `st` describes, counted as a hit, or nullptr.
+  std::shared_ptr<const DirectoryEntries> find(const struct stat &st)
+  {
+    if (!usable())
+      return nullptr;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    drain();
+
+    auto directory = directories.find({st.st_dev, st.st_ino});
+
+    if (directory == directories.end() or !directory->second.entries)
+      return nullptr;
+
+    if (directory->second.mtime.tv_sec != st.st_mtim.tv_sec or directory->second.mtime.tv_nsec != st.st_mtim.tv_nsec)
+    {
+      invalidate(directory);
+      return nullptr;
+    }
+
+    recent.splice(recent.begin(), recent, directory->second.use);
+    hits++;
+
+    return directory->second.entries;
+  }
+
+public:
+  EntryCache() : notify(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)), owner(getpid()) {}
+
+  EntryCache(const EntryCache &) = delete;
+  EntryCache &operator=(const EntryCache &) = delete;
+
+  ~EntryCache()
+  {
+    if (notify >= 0)
+      close(notify);
+  }
+
+  // The entries of the directory at `path`, read now only when no valid copy is cached; nullptr,
+  // with `error` set, when it cannot be read.
+  std::shared_ptr<const DirectoryEntries> get(const std::string &path, int &error)
+  {
+    struct stat st;
+
+    if (stat(path.c_str(), &st) < 0)
+    {
+      error = errno;
+      return nullptr;
+    }
+
+    if (!S_ISDIR(st.st_mode))
+    {
+      error = ENOTDIR;
+      return nullptr;
+    }
+
+    if (auto entries = find(st))
+      return entries;
+
+    misses++;
+
+    if (!usable())
+      return read(path, error);
+
+    // The watch goes in before the read, so a change made while reading still invalidates it.
+    int watch = inotify_add_watch(notify, path.c_str(), ENTRY_CACHE_EVENTS);
+    auto entries = read(path, error);
+
+    if (watch < 0)
+      return entries;
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (!entries)
+    {
+      if (watches.find(watch) == watches.end())
+        inotify_rm_watch(notify, watch);
+
+      return nullptr;
+    }
+
+    Key key{st.st_dev, st.st_ino};
+    auto directory = directories.find(key);
+
+    if (directory == directories.end())
+    {
+      recent.push_front(key);
+      directory = directories.emplace(key, Directory{watch, st.st_mtim, nullptr, recent.begin()}).first;
+      watches[watch] = key;
+    }
+    else
+    {
+      recent.splice(recent.begin(), recent, directory->second.use);
+
+      // The old watch went away between the lookup and now; its IN_IGNORED must not drop this copy.
+      if (directory->second.watch != watch)
+      {
+        watches.erase(directory->second.watch);
+        directory->second.watch = watch;
+        watches[watch] = key;
+      }
+    }
+
+    bytes -= directory->second.entries ? directory->second.entries->names.size() : 0;
+    directory->second.mtime = st.st_mtim;
+    directory->second.entries = entries;
+    bytes += entries->names.size();
+    trim();
+
+    return entries;
+  }
+
+  // Whether the directory at `path` has no entries, from the cache when it holds a valid copy; a
+  // miss reads a single getdents64 buffer and caches nothing.
+  bool isEmpty(const std::string &path)
+  {
+    struct stat st;
+
+    if (stat(path.c_str(), &st) == 0 and S_ISDIR(st.st_mode))
+      if (auto entries = find(st))
+        return entries->size() == 0;
+
+    misses++;
+
+    DirectoryStream &stream = EntryCache::stream();
+    const char *name;
+    unsigned char type;
+    bool empty = !stream.open(path) or !stream.fill() or !stream.next(name, type);
+
+    stream.close();
+    return empty;
+  }
+
+  EntryCacheStats stats()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t cached = 0;
+
+    for (const auto &[key, directory] : directories)
+      cached += directory.entries != nullptr;
+
+    return {cached, bytes, hits, misses, invalidations};
+  }
+};
+
+#endif
@@ -0,0 +1,571 @@
+#ifndef __HISTORY_HPP__
+#define __HISTORY_HPP__
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <queue>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define HISTORY_FILE "~/.shell_history"
+#define HISTORY_FRESH_LIMIT 4096
+#define HISTORY_BLOCK_SIZE 64
+#define HISTORY_RADIX_THRESHOLD 4096
+#define HISTORY_NONE SIZE_MAX
+#define HISTORY_SEARCH_LIMIT 50
+
+// The commands typed at the prompt, one per line in a file that is only ever appended to: each
+// command goes out in a single O_APPEND write, so shells running at the same time interleave whole
+// lines and nobody rewrites the file. Opening it maps the file and nothing more; the lines are found
+// the first time they are needed, and the search index is built on the first search.
+//
+// The index holds each distinct command once, under its latest entry. Sorted by text, with a range
+// maximum over the entry numbers, it yields the newest commands that start with a prefix without
+// looking at the others; in recency order, with a mask of the characters each one contains, it
+// is scanned for fuzzy matches. Entries appended after the index was built, by this shell or by
+// another, are kept aside in a small table and searched first, until there are enough of them to
+// make rebuilding worthwhile.
+class History
+{
+
+private:
+  struct Range
+  {
+    uint32_t newest;
+    size_t position;
+    size_t low;
+    size_t high;
+
+    bool operator<(const Range &other) const
+    {
+      return newest < other.newest;
+    }
+  };
+
+  int fd = -1;
+  char *base = nullptr;
+  size_t mappedSize = 0;
+  size_t scanned = 0;
+  std::vector<size_t> offsets = {0};
+
+  bool built = false;
+  size_t indexed = 0;
+  std::vector<uint32_t> sorted;
+  std::vector<std::vector<uint32_t>> blocks;
+  std::vector<uint32_t> recent;
+  std::vector<uint64_t> masks;
+  std::unordered_map<std::string_view, uint32_t> fresh;
+
+  std::string lastPrefix;
+  size_t lastLow = 0, lastHigh = 0;
+
+  // Where the last prefix search stopped, so that asking for the next older match carries on.
+  std::priority_queue<Range> pending;
+  std::string pendingPrefix;
+  size_t pendingBefore = HISTORY_NONE;
+
+  std::string_view text(size_t entry) const
+  {
+    return std::string_view(base + offsets[entry], offsets[entry + 1] - offsets[entry] - 1);
+  }
+
+  static uint64_t bitOf(unsigned char c)
+  {
+    if (c >= 'A' and c <= 'Z')
+      c += 'a' - 'A';
+
+    if (c >= 'a' and c <= 'z')
+      return 1ULL << (c - 'a');
+
+    if (c >= '0' and c <= '9')
+      return 1ULL << (26 + c - '0');
+
+    return 1ULL << (36 + c % 28);
+  }
+
+  static uint64_t maskOf(std::string_view s)
+  {
+    uint64_t mask = 0;
+
+    for (char c : s)
+      mask |= bitOf(c);
+
+    return mask;
+  }
+
+  static char lower(char c)
+  {
+    return c >= 'A' and c <= 'Z' ? c + 'a' - 'A' : c;
+  }
+
+  // Whether the characters of `pattern`, already in lower case, appear in `s` in that order.
+  static bool isSubsequence(std::string_view pattern, std::string_view s)
+  {
+    size_t next = 0;
+
+    for (size_t i = 0; i < s.size() and next < pattern.size(); i++)
+      if (lower(s[i]) == pattern[next])
+        next++;
+
+    return next == pattern.size();
+  }
+
+  // Maps whatever the file has grown to and finds the complete lines not seen yet.
+  void refresh()
+  {
+    struct stat st;
+
+    if (fd >= 0 and fstat(fd, &st) == 0 and static_cast<size_t>(st.st_size) != mappedSize)
+      map(st.st_size);
+
+    if (scanned == mappedSize)
+      return;
+
+    size_t first = offsets.size() - 1;
+
+    for (const char *p = base + scanned, *end = base + mappedSize;
+         (p = static_cast<const char *>(memchr(p, '\n', end - p))) != nullptr; p++)
+      offsets.push_back(p - base + 1);
+
+    scanned = mappedSize;
+
+    if (built)
+      for (size_t entry = first; entry < offsets.size() - 1; entry++)
+        fresh[text(entry)] = entry;
+  }
+
+  void map(size_t size)
+  {
+    char *previous = base;
+
+    // Growing in place keeps the pages already faulted in.
+    if (base and size > mappedSize)
+    {
+      base = static_cast<char *>(mremap(base, mappedSize, size, MREMAP_MAYMOVE));
+
+      if (base == MAP_FAILED)
+        munmap(previous, mappedSize);
+    }
+    else
+    {
+      if (base)
+        munmap(base, mappedSize);
+
+      base = size ? static_cast<char *>(mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0)) : nullptr;
+    }
+
+    mappedSize = size;
+
+    // Only appending is expected: a file that shrank, or cannot be mapped, is read from the start.
+    if (base == MAP_FAILED or size < scanned)
+    {
+      base = base == MAP_FAILED ? nullptr : base;
+      mappedSize = base ? size : 0;
+      offsets = {0};
+      scanned = 0;
+      built = false;
+    }
+    else
+      scanned = offsets.back();
+
+    if (base == previous)
+      return;
+
+    // The fresh table viewed the old mapping; it is small enough to be rebuilt.
+    fresh.clear();
+
+    if (built)
+      for (size_t entry = indexed; entry < offsets.size() - 1; entry++)
+        fresh[text(entry)] = entry;
+  }
+
+  // Position in `sorted` of the newest entry among sorted[low, high), which must not be empty.
+  size_t newest(size_t low, size_t high) const
+  {
+    auto better = [this](size_t a, size_t b)
+    { return sorted[a] >= sorted[b] ? a : b; };
+
+    if (high - low <= 2 * HISTORY_BLOCK_SIZE)
+    {
+      size_t best = low;
+
+      for (size_t i = low + 1; i < high; i++)
+        best = better(best, i);
+
+      return best;
+    }
+
+    size_t firstBlock = (low + HISTORY_BLOCK_SIZE - 1) / HISTORY_BLOCK_SIZE;
+    size_t lastBlock = high / HISTORY_BLOCK_SIZE;
+    size_t best = low;
+
+    for (size_t i = low; i < firstBlock * HISTORY_BLOCK_SIZE; i++)
+      best = better(best, i);
+
+    for (size_t i = lastBlock * HISTORY_BLOCK_SIZE; i < high; i++)
+      best = better(best, i);
+
+    if (firstBlock < lastBlock)
+    {
+      size_t level = 63 - __builtin_clzll(lastBlock - firstBlock);
+      best = better(best, blocks[level][firstBlock]);
+      best = better(best, blocks[level][lastBlock - (1ULL << level)]);
+    }
+
+    return best;
+  }
+
+  // Least significant byte first; a byte that is the same in every key costs no pass.
+  static void radixSort(std::vector<std::pair<uint64_t, uint32_t>> &keys, size_t begin, size_t end)
+  {
+    std::vector<std::pair<uint64_t, uint32_t>> buffer(end - begin);
+    auto *from = keys.data() + begin, *to = buffer.data();
+    size_t size = end - begin;
+
+    for (int shift = 0; shift < 64; shift += 8)
+    {
+      size_t counts[256] = {};
+
+      for (size_t i = 0; i < size; i++)
+        counts[(from[i].first >> shift) & 0xFF]++;
+
+      if (counts[(from[0].first >> shift) & 0xFF] == size)
+        continue;
+
+      for (size_t i = 0, total = 0; i < 256; i++)
+        total += std::exchange(counts[i], total);
+
+      for (size_t i = 0; i < size; i++)
+        to[counts[(from[i].first >> shift) & 0xFF]++] = from[i];
+
+      std::swap(from, to);
+    }
+
+    if (from != keys.data() + begin)
+      std::copy(from, from + size, keys.begin() + begin);
+  }
+
+  // Sorts keys[begin, end) by the text of their entries, eight bytes at a time from `depth` on:
+  // each round is an integer sort, and only the runs still tied go on to the next eight bytes.
+  void sortByText(std::vector<std::pair<uint64_t, uint32_t>> &keys, size_t begin, size_t end, size_t depth) const
+  {
+    for (size_t i = begin; i < end; i++)
+    {
+      std::string_view s = text(keys[i].second);
+      uint64_t key = 0;
+
+      for (size_t j = depth; j < depth + 8; j++)
+        key = key << 8 | (j < s.size() ? static_cast<unsigned char>(s[j]) : 0);
+
+      keys[i].first = key;
+    }
+
+    if (end - begin < HISTORY_RADIX_THRESHOLD)
+      std::sort(keys.begin() + begin, keys.begin() + end);
+    else
+      radixSort(keys, begin, end);
+
+    for (size_t first = begin; first < end;)
+    {
+      size_t last = first + 1;
+      bool longer = text(keys[first].second).size() > depth + 8;
+
+      for (; last < end and keys[last].first == keys[first].first; last++)
+        longer = longer or text(keys[last].second).size() > depth + 8;
+
+      if (last - first > 1 and longer)
+        sortByText(keys, first, last, depth + 8);
+
+      first = last;
+    }
+  }
+
+  void build()
+  {
+    size_t count = offsets.size() - 1;
+    size_t capacity = 1;
+
+    while (capacity < count * 2)
+      capacity <<= 1;
+
+    // Open addressing over the entries, newest first, so the first to claim a text is its latest.
+    // Each slot keeps part of the hash: most probes are settled without reading the text.
+    std::vector<std::pair<uint32_t, uint32_t>> table(capacity, {UINT32_MAX, 0});
+    recent.clear();
+
+    for (size_t entry = count; entry-- > 0;)
+    {
+      std::string_view s = text(entry);
+      size_t hash = std::hash<std::string_view>{}(s);
+      size_t slot = hash & (capacity - 1);
+
+      while (table[slot].first != UINT32_MAX and
+             (table[slot].second != static_cast<uint32_t>(hash) or text(table[slot].first) != s))
+        slot = (slot + 1) & (capacity - 1);
+
+      if (table[slot].first == UINT32_MAX)
+      {
+        table[slot] = {static_cast<uint32_t>(entry), static_cast<uint32_t>(hash)};
+        recent.push_back(entry);
+      }
+    }
+
+    std::vector<std::pair<uint64_t, uint32_t>> keys(recent.size());
+
+    for (size_t i = 0; i < recent.size(); i++)
+      keys[i].second = recent[i];
+
+    sortByText(keys, 0, keys.size(), 0);
+    sorted.resize(keys.size());
+
+    for (size_t i = 0; i < keys.size(); i++)
+      sorted[i] = keys[i].second;
+
+    masks.resize(recent.size());
+
+    for (size_t i = 0; i < recent.size(); i++)
+      masks[i] = maskOf(text(recent[i]));
+
+    size_t blockCount = sorted.size() / HISTORY_BLOCK_SIZE;
+    blocks.assign(1, std::vector<uint32_t>(blockCount));
+
+    for (size_t block = 0; block < blockCount; block++)
+    {
+      size_t best = block * HISTORY_BLOCK_SIZE;
+
+      for (size_t i = best + 1; i < (block + 1) * HISTORY_BLOCK_SIZE; i++)
+        if (sorted[i] > sorted[best])
+          best = i;
+
+      blocks[0][block] = best;
+    }
+
+    for (size_t level = 1; (1ULL << level) <= blockCount; level++)
+    {
+      const std::vector<uint32_t> &previous = blocks[level - 1];
+      std::vector<uint32_t> current(blockCount - (1ULL << level) + 1);
+
+      for (size_t block = 0; block < current.size(); block++)
+      {
+        uint32_t a = previous[block], b = previous[block + (1ULL << (level - 1))];
+        current[block] = sorted[a] >= sorted[b] ? a : b;
+      }
+
+      blocks.push_back(std::move(current));
+    }
+
+    indexed = count;
+    built = true;
+    fresh.clear();
+    lastPrefix.clear();
+    lastLow = 0;
+    lastHigh = sorted.size();
+    pendingBefore = HISTORY_NONE;
+  }
+
+  void prepare()
+  {
+    refresh();
+
+    if (!built or fresh.size() > HISTORY_FRESH_LIMIT)
+      build();
+  }
+
+  // The entries of `sorted` whose text starts with `prefix`. Typing one more character only
+  // searches inside the range of the previous prefix.
+  void prefixRange(std::string_view prefix, size_t &low, size_t &high)
+  {
+    low = 0;
+    high = sorted.size();
+
+    if (prefix.substr(0, lastPrefix.size()) == lastPrefix)
+    {
+      low = lastLow;
+      high = lastHigh;
+    }
+
+    auto head = [this, &prefix](uint32_t entry)
+    { return text(entry).substr(0, prefix.size()); };
+
+    low = std::partition_point(sorted.begin() + low, sorted.begin() + high, [&](uint32_t entry)
+                               { return head(entry) < prefix; }) -
+          sorted.begin();
+    high = std::partition_point(sorted.begin() + low, sorted.begin() + high, [&](uint32_t entry)
+                                { return head(entry) == prefix; }) -
+           sorted.begin();
+
+    lastPrefix = prefix;
+    lastLow = low;
+    lastHigh = high;
+  }
+
+  // Newest first, the fresh entries below `before` that are their command's latest occurrence.
+  template <typename Predicate>
+  void searchFresh(size_t before, size_t limit, std::vector<size_t> &matches, Predicate matches_)
+  {
+    for (size_t entry = std::min(before, offsets.size() - 1); entry-- > indexed and matches.size() < limit;)
+    {
+      std::string_view s = text(entry);
+
+      auto latest = fresh.find(s);
+
+      if (latest != fresh.end() and latest->second == entry and matches_(s))
+        matches.push_back(entry);
+    }
+  }
+
+public:
+  History() = default;
+  History(const History &) = delete;
+  History &operator=(const History &) = delete;
+
+  // Opens, creating it if needed, and maps the history file. Returns false, with errno set, when
+  // it cannot be opened; the shell then simply runs without history.
+  bool open(const std::string &file)
+  {
+    fd = ::open(file.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, S_IRUSR | S_IWUSR);
+
+    if (fd < 0)
+      return false;
+
+    struct stat st;
+
+    if (fstat(fd, &st) == 0)
+      map(st.st_size);
+
+    return true;
+  }
+
+  bool isOpen() const
+  {
+    return fd >= 0;
+  }
+
+  // Appends one command; blank lines are not recorded.
+  bool add(std::string_view line)
+  {
+    if (fd < 0 or line.find_first_not_of(" \t") == std::string_view::npos)
+      return false;
+
+    std::string record(line);
+    record += '\n';
+
+    return write(fd, record.data(), record.size()) == static_cast<ssize_t>(record.size());
+  }
+
+  size_t size()
+  {
+    refresh();
+    return offsets.size() - 1;
+  }
+
+  // The command of an entry below size().
+  std::string_view at(size_t entry) const
+  {
+    return text(entry);
+  }
+
+  // The newest distinct commands below entry `before` that start with `prefix`, newest first.
+  void searchPrefix(std::string_view prefix, size_t before, size_t limit, std::vector<size_t> &matches)
+  {
+    matches.clear();
+    prepare();
+
+    searchFresh(before, limit, matches, [&prefix](std::string_view s)
+                { return s.substr(0, prefix.size()) == prefix; });
+
+    std::priority_queue<Range> ranges;
+
+    if (matches.size() == limit)
+      return;
+
+    if (before <= indexed and before == pendingBefore and prefix == pendingPrefix)
+      std::swap(ranges, pending);
+    else
+    {
+      size_t low, high;
+      prefixRange(prefix, low, high);
+
+      if (low < high)
+      {
+        size_t position = newest(low, high);
+        ranges.push({sorted[position], position, low, high});
+      }
+    }
+
+    while (!ranges.empty() and matches.size() < limit)
+    {
+      Range range = ranges.top();
+      ranges.pop();
+
+      if (range.newest < before and !fresh.count(text(range.newest)))
+        matches.push_back(range.newest);
+
+      if (range.low < range.position)
+      {
+        size_t position = newest(range.low, range.position);
+        ranges.push({sorted[position], position, range.low, range.position});
+      }
+
+      if (range.position + 1 < range.high)
+      {
+        size_t position = newest(range.position + 1, range.high);
+        ranges.push({sorted[position], position, range.position + 1, range.high});
+      }
+    }
+
+    pendingBefore = matches.size() == limit ? matches.back() : HISTORY_NONE;
+    pendingPrefix = prefix;
+    std::swap(pending, ranges);
+  }
+
+  // The newest distinct commands below entry `before` containing the characters of `pattern` in
+  // order, ignoring case; newest first.
+  void searchFuzzy(std::string_view pattern, size_t before, size_t limit, std::vector<size_t> &matches)
+  {
+    matches.clear();
+    prepare();
+
+    std::string needle(pattern);
+    std::transform(needle.begin(), needle.end(), needle.begin(), lower);
+    uint64_t mask = maskOf(needle);
+
+    searchFresh(before, limit, matches, [&needle](std::string_view s)
+                { return isSubsequence(needle, s); });
+
+    size_t start = std::partition_point(recent.begin(), recent.end(), [before](uint32_t entry)
+                                        { return entry >= before; }) -
+                   recent.begin();
+
+    for (size_t i = start; i < recent.size() and matches.size() < limit; i++)
+    {
+      if ((masks[i] & mask) != mask)
+        continue;
+
+      std::string_view s = text(recent[i]);
+
+      if (isSubsequence(needle, s) and !fresh.count(s))
+        matches.push_back(recent[i]);
+    }
+  }
+
+  ~History()
+  {
+    if (base)
+      munmap(base, mappedSize);
+
+    if (fd >= 0)
+      close(fd);
+  }
+};
+
+#endif
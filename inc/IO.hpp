@@ -2,9 +2,18 @@
 #define __IO_HPP__
 
 #include <iostream>
-#include <fstream>
 #include <string>
+#include <string_view>
 #include <sstream>
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/uio.h>
 
 #include "Utils.hpp"
 
@@ -17,44 +26,399 @@
 #define STDIN_STREAM "stdin"
 #define STDOUT_STREAM "stdout"
 
+// Pieces a single write gathers on the stack; longer lists take a heap-allocated vector.
+#define OUTPUT_INLINE_PIECES 8
+
+#define INPUT_BUFFER_SIZE (64 * 1024)
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+
+// Pulls input in large blocks into a reusable buffer and hands out lines as views into it.
+// A line stays valid until the next call; only a line longer than the buffer makes it grow.
+class LineReader
+{
+
+private:
+  int fd;
+  bool ownsDescriptor;
+  std::istream *stream;
+  std::unique_ptr<char[]> buffer;
+  size_t capacity;
+  size_t position;
+  size_t filled;
+  bool eof;
+
+  ssize_t fill(char *destination, size_t size)
+  {
+    if (stream)
+    {
+      std::streambuf *source = stream->rdbuf();
+
+      if (source->in_avail() <= 0 and source->sgetc() == std::char_traits<char>::eof())
+        return 0;
+
+      std::streamsize available = std::max<std::streamsize>(source->in_avail(), 1);
+      return source->sgetn(destination, std::min<std::streamsize>(available, size));
+    }
+
+    ssize_t nread;
+
+    do
+      nread = ::read(fd, destination, size);
+    while (nread < 0 and errno == EINTR);
+
+    return nread;
+  }
+
+  void reset()
+  {
+    if (ownsDescriptor)
+      close(fd);
+
+    fd = -1;
+    ownsDescriptor = false;
+    stream = nullptr;
+    position = filled = 0;
+    eof = false;
+  }
+
+public:
+  class iterator
+  {
+
+  private:
+    LineReader *reader;
+    std::string_view line;
+
+  public:
+    explicit iterator(LineReader *r = nullptr) : reader(r)
+    {
+      ++*this;
+    }
+
+    std::string_view operator*() const { return line; }
+
+    iterator &operator++()
+    {
+      if (reader and !reader->next(line))
+        reader = nullptr;
+      return *this;
+    }
+
+    bool operator!=(const iterator &other) const { return reader != other.reader; }
+  };
+
+  LineReader() : fd(-1), ownsDescriptor(false), stream(nullptr), buffer(new char[INPUT_BUFFER_SIZE]), capacity(INPUT_BUFFER_SIZE), position(0), filled(0), eof(false) {}
+
+  LineReader(const LineReader &) = delete;
+  LineReader &operator=(const LineReader &) = delete;
+
+  void open(int descriptor, bool owns = false)
+  {
+    reset();
+    fd = descriptor;
+    ownsDescriptor = owns;
+  }
+
+  void open(std::istream &source)
+  {
+    reset();
+    stream = &source;
+  }
+
+  bool next(std::string_view &line)
+  {
+    while (true)
+    {
+      const char *newline = static_cast<const char *>(memchr(buffer.get() + position, '\n', filled - position));
+
+      if (newline)
+      {
+        line = std::string_view(buffer.get() + position, newline - (buffer.get() + position));
+        position = newline - buffer.get() + 1;
+        return true;
+      }
+
+      if (eof)
+      {
+        if (position == filled)
+          return false;
+
+        line = std::string_view(buffer.get() + position, filled - position);
+        position = filled;
+        return true;
+      }
+
+      if (position > 0)
+      {
+        memmove(buffer.get(), buffer.get() + position, filled - position);
+        filled -= position;
+        position = 0;
+      }
+
+      if (filled == capacity)
+      {
+        std::unique_ptr<char[]> larger(new char[capacity * 2]);
+        memcpy(larger.get(), buffer.get(), filled);
+        buffer = std::move(larger);
+        capacity *= 2;
+      }
+
+      ssize_t nread = fill(buffer.get() + filled, capacity - filled);
+
+      if (nread <= 0)
+        eof = true;
+      else
+        filled += nread;
+    }
+  }
+
+  // Whether the next line, or the end of the input, can be handed out without reading.
+  bool hasLine() const
+  {
+    return eof or memchr(buffer.get() + position, '\n', filled - position) != nullptr;
+  }
+
+  // Raw bytes: what is already buffered first, then straight from the source.
+  ssize_t read(char *destination, size_t size)
+  {
+    if (position < filled)
+    {
+      size = std::min(size, filled - position);
+      memcpy(destination, buffer.get() + position, size);
+      position += size;
+      return size;
+    }
+
+    return eof ? 0 : fill(destination, size);
+  }
+
+  iterator begin()
+  {
+    return iterator(this);
+  }
+
+  iterator end()
+  {
+    return iterator();
+  }
+
+  ~LineReader()
+  {
+    reset();
+  }
+};
+
+// Buffers output in userspace and hands it to the kernel in large blocks. Terminals still get
+// each line as soon as it is complete. A piece that does not fit in the buffer is written
+// together with the buffered bytes through a single writev instead of being copied.
+class OutputWriter
+{
+
+private:
+  int fd;
+  std::ostream *stream;
+  bool lineBuffered;
+  std::unique_ptr<char[]> buffer;
+  size_t used;
+
+  bool writeVector(struct iovec *pieces, int count)
+  {
+    while (count > 0)
+    {
+      ssize_t nwritten = writev(fd, pieces, count);
+
+      if (nwritten < 0)
+      {
+        if (errno == EINTR)
+          continue;
+        return false;
+      }
+
+      while (count > 0 and static_cast<size_t>(nwritten) >= pieces->iov_len)
+      {
+        nwritten -= pieces->iov_len;
+        pieces++;
+        count--;
+      }
+
+      if (count > 0)
+      {
+        pieces->iov_base = static_cast<char *>(pieces->iov_base) + nwritten;
+        pieces->iov_len -= nwritten;
+      }
+    }
+
+    return true;
+  }
+
+public:
+  OutputWriter() : fd(STDOUT_FILENO), stream(nullptr), lineBuffered(isatty(STDOUT_FILENO)), buffer(new char[OUTPUT_BUFFER_SIZE]), used(0) {}
+
+  OutputWriter(const OutputWriter &) = delete;
+  OutputWriter &operator=(const OutputWriter &) = delete;
+
+  void open(int descriptor)
+  {
+    flush();
+    fd = descriptor;
+    stream = nullptr;
+    lineBuffered = isatty(fd);
+  }
+
+  void open(std::ostream &destination)
+  {
+    flush();
+    fd = -1;
+    stream = &destination;
+    lineBuffered = false;
+  }
+
+  int getDescriptor() const
+  {
+    return fd;
+  }
+
+  void write(const std::string_view *pieces, size_t count)
+  {
+    if (stream)
+    {
+      for (size_t i = 0; i < count; i++)
+        stream->write(pieces[i].data(), pieces[i].size());
+      return;
+    }
+
+    size_t total = 0;
+    bool newline = false;
+
+    for (size_t i = 0; i < count; i++)
+    {
+      total += pieces[i].size();
+      newline = newline or (lineBuffered and memchr(pieces[i].data(), '\n', pieces[i].size()));
+    }
+
+    if (used + total > OUTPUT_BUFFER_SIZE)
+    {
+      if (fd == STDOUT_FILENO)
+        fflush(stdout);
+
+      struct iovec inlineVector[1 + OUTPUT_INLINE_PIECES];
+      std::vector<struct iovec> heapVector;
+      struct iovec *vector = inlineVector;
+      int n = 0;
+
+      if (count > OUTPUT_INLINE_PIECES)
+      {
+        heapVector.resize(1 + count);
+        vector = heapVector.data();
+      }
+
+      if (used > 0)
+        vector[n++] = {buffer.get(), used};
+
+      for (size_t i = 0; i < count; i++)
+        if (!pieces[i].empty())
+          vector[n++] = {const_cast<char *>(pieces[i].data()), pieces[i].size()};
+
+      writeVector(vector, n);
+      used = 0;
+      return;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+      memcpy(buffer.get() + used, pieces[i].data(), pieces[i].size());
+      used += pieces[i].size();
+    }
+
+    if (newline)
+      flush();
+  }
+
+  void write(std::string_view piece)
+  {
+    write(&piece, 1);
+  }
+
+  void flush()
+  {
+    if (stream)
+    {
+      stream->flush();
+      return;
+    }
+
+    if (used == 0)
+      return;
+
+    if (fd == STDOUT_FILENO)
+      fflush(stdout);
+
+    struct iovec vector = {buffer.get(), used};
+    writeVector(&vector, 1);
+    used = 0;
+  }
+
+  ~OutputWriter()
+  {
+    flush();
+  }
+};
+
 class IO
 {
 
 private:
-  std::istream *input;
-  std::ostream *output;
+  LineReader stdinReader;
+  LineReader fileReader;
+  LineReader *input;
+  OutputWriter output;
   std::string lastSource;
   std::string lastDestination;
   bool endOfFile;
 
+  void closeInputStream()
+  {
+    fileReader.open(-1);
+    input = &stdinReader;
+  }
+
+  void closeOutputStream()
+  {
+    int fd = output.getDescriptor();
+
+    output.open(STDOUT_FILENO);
+
+    if (fd > STDERR_FILENO)
+      close(fd);
+  }
+
 public:
-  IO() : input(&std::cin), output(&std::cout), lastSource(STDIN_STREAM), lastDestination(STDOUT_STREAM), endOfFile(false) {}
+  IO() : input(&stdinReader), lastSource(STDIN_STREAM), lastDestination(STDOUT_STREAM), endOfFile(false)
+  {
+    stdinReader.open(STDIN_FILENO);
+  }
 
   int setInputStream(const std::string &source)
   {
     if (source == STDIN_STREAM)
     {
-      input = &std::cin;
+      closeInputStream();
       endOfFile = false;
     }
     else if (trim(source) != trim(lastSource))
     {
-      if (input != &std::cin)
-      {
-        dynamic_cast<std::ifstream *>(input)->close();
-        delete input;
-      }
+      closeInputStream();
 
-      std::ifstream *inputFile = new std::ifstream(source);
-      if (inputFile->is_open())
+      int fd = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd >= 0)
       {
-        input = inputFile;
+        fileReader.open(fd, true);
+        input = &fileReader;
         endOfFile = false;
       }
       else
       {
         std::cerr << "Failed to open input file!" << std::endl;
-        delete inputFile;
         return INPUT_STREAM_FAIL;
       }
     }
@@ -65,41 +429,72 @@ public:
 
   int setInputStream(std::istream &source)
   {
-    input = &source;
+    closeInputStream();
+    fileReader.open(source);
+    input = &fileReader;
     lastSource = "";
     endOfFile = false;
     return INPUT_STREAM_SUCCESS;
   }
 
+  // Drops what was read ahead from stdin, for when descriptor 0 has been replaced.
+  void resetStdinStream()
+  {
+    stdinReader.open(STDIN_FILENO);
+    input = &stdinReader;
+    endOfFile = false;
+  }
+
+  bool getInputLine(std::string_view &line)
+  {
+    if (!endOfFile and input->next(line))
+      return true;
+
+    endOfFile = true;
+    return false;
+  }
+
   std::string getInputLine()
   {
-    std::string line;
-    if (!endOfFile)
-    {
-      if (std::getline(*input, line))
-        return line;
-      else
-        endOfFile = true;
-    }
+    std::string_view line;
+
+    if (getInputLine(line))
+      return std::string(line);
 
     return "";
   }
 
   std::string getAllInputLines()
   {
-    std::string line, lines = "";
-    
-    while (true)
+    std::string lines;
+    std::string_view line;
+
+    while (getInputLine(line))
     {
-      line = this->getInputLine();
-      if (this->isEof())
-        break;
-      lines += line + '\n';
+      lines.append(line);
+      lines += '\n';
     }
 
     return lines;
   }
 
+  LineReader &getInputLines()
+  {
+    return *input;
+  }
+
+  // The shell's own stdin, even while the command's input is redirected.
+  LineReader &getStdinLines()
+  {
+    return stdinReader;
+  }
+
+  // Reads whatever raw input is available, up to `size` bytes; 0 means the input is exhausted.
+  ssize_t read(char *buffer, size_t size)
+  {
+    return input->read(buffer, size);
+  }
+
   bool isEof() const
   {
     return endOfFile;
@@ -107,28 +502,23 @@ public:
 
   bool isStdinStream()
   {
-    return input == &std::cin;
+    return input == &stdinReader;
   }
 
   int setOutputStream(const std::string &destination)
   {
     if (destination == STDOUT_STREAM)
-      output = &std::cout;
+      closeOutputStream();
     else if (trim(destination) != trim(lastDestination))
     {
-      if (output != &std::cout)
-      {
-        dynamic_cast<std::ofstream *>(output)->close();
-        delete output;
-      }
+      closeOutputStream();
 
-      std::ofstream *outputFile = new std::ofstream(destination, std::ofstream::out);
-      if (outputFile->is_open())
-        output = outputFile;
+      int fd = open(destination.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+      if (fd >= 0)
+        output.open(fd);
       else
       {
         std::cerr << "Failed to open output file!" << std::endl;
-        delete outputFile;
         return OUTPUT_STREAM_FAIL;
       }
     }
@@ -138,26 +528,48 @@ public:
     return OUTPUT_STREAM_SUCCESS;
   }
 
-  void setOutputLine(const std::string &line)
+  // Writes to a stream owned by the caller, such as a pipeline stage; there is no descriptor behind it.
+  int setOutputStream(std::ostream &destination)
   {
-    *output << line << std::endl;
+    closeOutputStream();
+    output.open(destination);
+    lastDestination = "";
+    return OUTPUT_STREAM_SUCCESS;
   }
 
-  void setOutput(const std::string &str)
+  // Flushes the buffered output, and stdout's when it is the target, so the caller can write to
+  // the descriptor directly.
+  int getOutputDescriptor()
   {
-    *output << str;
+    output.flush();
+
+    if (output.getDescriptor() == STDOUT_FILENO)
+      fflush(stdout);
+
+    return output.getDescriptor();
+  }
+
+  void setOutputLine(std::string_view line)
+  {
+    const std::string_view pieces[] = {line, "\n"};
+    output.write(pieces, 2);
+  }
+
+  void setOutput(std::string_view str)
+  {
+    output.write(str);
+  }
+
+  void flush()
+  {
+    output.flush();
   }
 
   ~IO()
   {
-    if (input != &std::cin)
-    {
-      dynamic_cast<std::ifstream *>(input)->close();
-      delete input;
-    }
+    closeInputStream();
 
-    if (output != &std::cout)
-      delete output;
+    closeOutputStream();
   }
 };
 
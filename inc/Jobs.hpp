@@ -0,0 +1,305 @@
+#ifndef __JOBS_HPP__
+#define __JOBS_HPP__
+
+#include <cerrno>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#define JOB_EVENT_SIGNAL 0
+#define JOB_EVENT_INPUT UINT64_MAX
+#define JOB_EVENT_BATCH 64
+
+enum JobState
+{
+  JOB_RUNNING,
+  JOB_STOPPED,
+  JOB_DONE
+};
+
+struct Job
+{
+  int id;
+  pid_t pid;
+  pid_t group;
+  int pidfd;
+  std::string command;
+  JobState state;
+  int status;
+  bool changed;
+};
+
+// Background jobs of the shell. An exit is seen through the job's pidfd and a stop or continue
+// through a SIGCHLD signalfd, all in one epoll set, so an idle shell sleeps in a single
+// epoll_wait however many jobs it has, and every child is reaped as soon as it ends.
+class JobTable
+{
+
+private:
+  int epollFd;
+  int signalFd;
+  int inputFd;
+  std::map<int, Job> jobs;
+
+  void watch(int fd, uint64_t key)
+  {
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.u64 = key;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+  }
+
+  void finish(Job &job, int status)
+  {
+    job.state = JOB_DONE;
+    job.status = status;
+    job.changed = true;
+
+    if (job.pidfd >= 0)
+    {
+      epoll_ctl(epollFd, EPOLL_CTL_DEL, job.pidfd, nullptr);
+      close(job.pidfd);
+      job.pidfd = -1;
+    }
+  }
+
+  void reap(Job &job)
+  {
+    int status;
+
+    if (job.state != JOB_DONE and waitpid(job.pid, &status, WNOHANG) == job.pid)
+      finish(job, status);
+  }
+
+  // Stops and continues have no pidfd event; waitid without WEXITED collects only those.
+  void collectSignals()
+  {
+    struct signalfd_siginfo info;
+
+    while (read(signalFd, &info, sizeof(info)) == sizeof(info))
+      ;
+
+    siginfo_t child;
+
+    while (true)
+    {
+      child.si_pid = 0;
+
+      if (waitid(P_ALL, 0, &child, WSTOPPED | WCONTINUED | WNOHANG) < 0 or child.si_pid == 0)
+        break;
+
+      Job *job = findByPid(child.si_pid);
+
+      if (job == nullptr)
+        continue;
+
+      // A resume is always the shell's own doing through fg or bg; only a stop is news.
+      job->changed = job->changed or child.si_code == CLD_STOPPED;
+      job->state = child.si_code == CLD_STOPPED ? JOB_STOPPED : JOB_RUNNING;
+    }
+
+    for (auto &[id, job] : jobs)
+      if (job.pidfd < 0)
+        reap(job);
+  }
+
+  // Handles what is ready within `timeout` milliseconds; returns whether the input became readable.
+  bool dispatch(int timeout)
+  {
+    struct epoll_event events[JOB_EVENT_BATCH];
+    int count;
+
+    do
+      count = epoll_wait(epollFd, events, JOB_EVENT_BATCH, timeout);
+    while (count < 0 and errno == EINTR);
+
+    bool inputReady = false;
+
+    for (int i = 0; i < count; i++)
+    {
+      uint64_t key = events[i].data.u64;
+
+      if (key == JOB_EVENT_INPUT)
+        inputReady = true;
+      else if (key == JOB_EVENT_SIGNAL)
+        collectSignals();
+      else if (Job *job = find(static_cast<int>(key)))
+        reap(*job);
+    }
+
+    return inputReady;
+  }
+
+public:
+  JobTable() : epollFd(epoll_create1(EPOLL_CLOEXEC)), signalFd(-1), inputFd(-1)
+  {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &signals, nullptr);
+
+    signalFd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    watch(signalFd, JOB_EVENT_SIGNAL);
+  }
+
+  JobTable(const JobTable &) = delete;
+  JobTable &operator=(const JobTable &) = delete;
+
+  // `group` is the job's own process group, or 0 when it shares the shell's.
+  int add(pid_t pid, pid_t group, const std::string &command, JobState state = JOB_RUNNING)
+  {
+    int id = jobs.empty() ? 1 : jobs.rbegin()->first + 1;
+    int pidfd = syscall(SYS_pidfd_open, pid, 0);
+
+    jobs[id] = {id, pid, group, pidfd, command, state, 0, false};
+
+    if (pidfd >= 0)
+      watch(pidfd, id);
+
+    return id;
+  }
+
+  Job *find(int id)
+  {
+    auto job = jobs.find(id);
+    return job == jobs.end() ? nullptr : &job->second;
+  }
+
+  Job *findByPid(pid_t pid)
+  {
+    for (auto &[id, job] : jobs)
+      if (job.pid == pid)
+        return &job;
+
+    return nullptr;
+  }
+
+  // The most recent job that has not finished yet.
+  Job *current()
+  {
+    for (auto job = jobs.rbegin(); job != jobs.rend(); job++)
+      if (job->second.state != JOB_DONE)
+        return &job->second;
+
+    return nullptr;
+  }
+
+  std::map<int, Job> &list()
+  {
+    return jobs;
+  }
+
+  bool empty() const
+  {
+    return jobs.empty();
+  }
+
+  void remove(int id)
+  {
+    Job *job = find(id);
+
+    if (job == nullptr)
+      return;
+
+    if (job->pidfd >= 0)
+    {
+      epoll_ctl(epollFd, EPOLL_CTL_DEL, job->pidfd, nullptr);
+      close(job->pidfd);
+    }
+
+    jobs.erase(id);
+  }
+
+  int signal(const Job &job, int signal)
+  {
+    return kill(job.group > 0 ? -job.group : job.pid, signal);
+  }
+
+  // Waits in the foreground: returns once the job has exited or stopped again.
+  void waitForeground(Job &job)
+  {
+    int status;
+    pid_t pid;
+
+    do
+      pid = waitpid(job.pid, &status, WUNTRACED);
+    while (pid < 0 and errno == EINTR);
+
+    if (pid != job.pid)
+      finish(job, 0);
+    else if (WIFSTOPPED(status))
+    {
+      job.state = JOB_STOPPED;
+      job.changed = true;
+    }
+    else
+      finish(job, status);
+  }
+
+  // Reaps whatever has ended without blocking.
+  void poll()
+  {
+    dispatch(0);
+  }
+
+  // Sleeps until the job, or every job when `id` is 0, has finished.
+  void wait(int id = 0)
+  {
+    while (true)
+    {
+      bool pending = false;
+
+      for (auto &[jobId, job] : jobs)
+        pending = pending or ((id == 0 or jobId == id) and job.state == JOB_RUNNING);
+
+      if (!pending)
+        return;
+
+      dispatch(-1);
+    }
+  }
+
+  // Sleeps until `fd` is readable, calling `onChange` whenever a job changes state meanwhile.
+  // Descriptors epoll cannot watch, such as regular files, are always ready.
+  template <typename Callback>
+  void waitForInput(int fd, Callback onChange)
+  {
+    if (inputFd != fd)
+    {
+      if (inputFd >= 0)
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, inputFd, nullptr);
+
+      struct epoll_event event = {};
+      event.events = EPOLLIN;
+      event.data.u64 = JOB_EVENT_INPUT;
+      inputFd = epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) == 0 ? fd : -1;
+    }
+
+    if (inputFd < 0)
+    {
+      poll();
+      return;
+    }
+
+    while (!dispatch(-1))
+      onChange();
+  }
+
+  ~JobTable()
+  {
+    for (auto &[id, job] : jobs)
+      if (job.pidfd >= 0)
+        close(job.pidfd);
+
+    close(signalFd);
+    close(epollFd);
+  }
+};
+
+#endif
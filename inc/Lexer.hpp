@@ -0,0 +1,130 @@
+#ifndef __LEXER_HPP__
+#define __LEXER_HPP__
+
+#include <string_view>
+#include <vector>
+#include <cstddef>
+
+enum TokenType
+{
+  WORD,
+  QUOTED,
+  PIPE,
+  INPUT_REDIRECTION,
+  OUTPUT_REDIRECTION,
+  BACKGROUND
+};
+
+struct Token
+{
+  TokenType type;
+  std::string_view text;
+
+  bool isWord() const
+  {
+    return type == WORD or type == QUOTED;
+  }
+};
+
+using Tokens = std::vector<Token>;
+
+struct TokenSpan
+{
+  const Token *first;
+  const Token *last;
+
+  TokenSpan() : first(nullptr), last(nullptr) {}
+  TokenSpan(const Token *f, const Token *l) : first(f), last(l) {}
+  TokenSpan(const Tokens &tokens) : first(tokens.data()), last(tokens.data() + tokens.size()) {}
+
+  const Token *begin() const { return first; }
+  const Token *end() const { return last; }
+  size_t size() const { return last - first; }
+  bool empty() const { return first == last; }
+  const Token &operator[](size_t i) const { return first[i]; }
+};
+
+// Splits a command line into tokens in a single pass. Tokens point into the line, so it
+// must outlive them; the token vector is reused between calls.
+class Lexer
+{
+
+private:
+  Tokens tokens;
+
+  static bool isBlank(char c)
+  {
+    return c == ' ' or c == '\t' or c == '\n' or c == '\r' or c == '\v' or c == '\f';
+  }
+
+  static bool isOperator(char c)
+  {
+    return c == '|' or c == '<' or c == '>' or c == '&';
+  }
+
+public:
+  static void tokenize(std::string_view line, Tokens &tokens)
+  {
+    tokens.clear();
+
+    const char *p = line.data();
+    const char *end = p + line.size();
+
+    while (p < end)
+    {
+      if (isBlank(*p))
+      {
+        p++;
+        continue;
+      }
+
+      switch (*p)
+      {
+      case '|':
+        tokens.push_back({PIPE, std::string_view(p++, 1)});
+        continue;
+      case '<':
+        tokens.push_back({INPUT_REDIRECTION, std::string_view(p++, 1)});
+        continue;
+      case '>':
+        tokens.push_back({OUTPUT_REDIRECTION, std::string_view(p++, 1)});
+        continue;
+      case '&':
+        tokens.push_back({BACKGROUND, std::string_view(p++, 1)});
+        continue;
+      case '"':
+      case '\'':
+      {
+        const char quote = *p++;
+        const char *start = p;
+
+        while (p < end and *p != quote)
+          p++;
+
+        tokens.push_back({QUOTED, std::string_view(start, p - start)});
+
+        if (p < end)
+          p++;
+        continue;
+      }
+      default:
+        break;
+      }
+
+      const char *start = p;
+
+      while (p < end and !isBlank(*p) and !isOperator(*p) and *p != '"' and *p != '\'')
+        p++;
+
+      tokens.push_back({WORD, std::string_view(start, p - start)});
+    }
+  }
+
+  const Tokens &tokenize(std::string_view line)
+  {
+    tokenize(line, tokens);
+    return tokens;
+  }
+};
+
+#endif
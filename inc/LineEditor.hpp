@@ -0,0 +1,616 @@
+#ifndef __LINE_EDITOR_HPP__
+#define __LINE_EDITOR_HPP__
+
+#include <algorithm>
+#include <cerrno>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "Completion.hpp"
+#include "History.hpp"
+
+#define EDITOR_DEFAULT_WIDTH 80
+#define EDITOR_READ_SIZE 256
+
+#define KEY_CTRL(c) ((c) & 0x1F)
+#define KEY_BACKSPACE 127
+#define KEY_ESCAPE 27
+
+// Reads a line from the terminal in raw mode, with the usual emacs keys, history through the arrows
+// (only the entries that start with what was typed, once something was) and ^R, and completion on
+// Tab. The terminal is back in its own mode while the line runs. A line wider than the terminal
+// scrolls sideways instead of wrapping, so a redraw is always the same few escape sequences.
+class LineEditor
+{
+
+private:
+  int input;
+  int output;
+  History &history;
+  Completer &completer;
+
+  struct termios original;
+  std::function<void()> waitForInput;
+  std::string pending;
+  size_t consumed = 0;
+
+  std::string prompt;
+  std::string line;
+  size_t cursor = 0;
+  bool listing = false;
+
+  std::string typed;
+  std::vector<size_t> visited;
+
+  void send(std::string_view text)
+  {
+    while (!text.empty())
+    {
+      ssize_t written = ::write(output, text.data(), text.size());
+
+      if (written < 0 and errno == EINTR)
+        continue;
+
+      if (written <= 0)
+        return;
+
+      text.remove_prefix(written);
+    }
+  }
+
+  size_t width() const
+  {
+    struct winsize size;
+
+    if (ioctl(output, TIOCGWINSZ, &size) < 0 or size.ws_col == 0)
+      return EDITOR_DEFAULT_WIDTH;
+
+    return size.ws_col;
+  }
+
+  // Columns taken by UTF-8 text: one for each byte that starts a character.
+  static size_t columns(std::string_view text)
+  {
+    return std::count_if(text.begin(), text.end(), [](char c)
+                         { return (c & 0xC0) != 0x80; });
+  }
+
+  // Byte offset of the character `count` characters into `text`.
+  static size_t advance(std::string_view text, size_t count)
+  {
+    size_t offset = 0;
+
+    while (offset < text.size() and count > 0)
+    {
+      offset++;
+
+      while (offset < text.size() and (text[offset] & 0xC0) == 0x80)
+        offset++;
+
+      count--;
+    }
+
+    return offset;
+  }
+
+  bool next(char &c)
+  {
+    if (consumed == pending.size())
+    {
+      if (waitForInput)
+        waitForInput();
+
+      char buffer[EDITOR_READ_SIZE];
+      ssize_t count;
+
+      do
+        count = ::read(input, buffer, sizeof(buffer));
+      while (count < 0 and errno == EINTR);
+
+      if (count <= 0)
+        return false;
+
+      pending.assign(buffer, count);
+      consumed = 0;
+    }
+
+    c = pending[consumed++];
+    return true;
+  }
+
+  void insert(std::string_view text)
+  {
+    line.insert(cursor, text);
+    cursor += text.size();
+  }
+
+  void left()
+  {
+    while (cursor > 0 and (line[--cursor] & 0xC0) == 0x80)
+      ;
+  }
+
+  void right()
+  {
+    if (cursor < line.size())
+      cursor += advance(std::string_view(line).substr(cursor), 1);
+  }
+
+  void erase(size_t from, size_t to)
+  {
+    line.erase(from, to - from);
+    cursor = from;
+  }
+
+  // Up and down walk the distinct commands, newest first, that start with what was typed.
+  void older()
+  {
+    if (visited.empty())
+      typed = line;
+
+    std::vector<size_t> matches;
+    history.searchPrefix(typed, visited.empty() ? HISTORY_NONE : visited.back(), 1, matches);
+
+    if (matches.empty())
+      return;
+
+    visited.push_back(matches[0]);
+    line = history.at(matches[0]);
+    cursor = line.size();
+  }
+
+  void newer()
+  {
+    if (visited.empty())
+      return;
+
+    visited.pop_back();
+    line = visited.empty() ? typed : std::string(history.at(visited.back()));
+    cursor = line.size();
+  }
+
+  // ^R: each key refines the query and shows the newest command matching it fuzzily; ^R again
+  // moves to an older one. Returns the key that ended the search, to be handled as usual, or 0.
+  char reverseSearch()
+  {
+    std::string saved = line, savedPrompt = prompt, query;
+    size_t match = HISTORY_NONE;
+    bool failed = false;
+    std::vector<size_t> matches;
+    char c = 0;
+
+    auto search = [&](size_t before)
+    {
+      history.searchFuzzy(query, before, 1, matches);
+      failed = matches.empty();
+
+      if (!failed)
+      {
+        match = matches[0];
+        line = history.at(match);
+      }
+    };
+
+    while (true)
+    {
+      prompt = std::string(failed ? "(failed reverse-i-search)`" : "(reverse-i-search)`") + query + "': ";
+      cursor = line.size();
+      refresh();
+
+      if (!next(c))
+        break;
+
+      if (c == KEY_CTRL('r'))
+        search(match);
+      else if (c == KEY_BACKSPACE or c == KEY_CTRL('h'))
+      {
+        if (!query.empty())
+          query.erase(advance(query, columns(query) - 1));
+
+        search(HISTORY_NONE);
+      }
+      else if (c == KEY_CTRL('g') or c == KEY_CTRL('c'))
+      {
+        line = saved;
+        c = 0;
+        break;
+      }
+      else if (static_cast<unsigned char>(c) >= ' ')
+      {
+        query += c;
+        search(HISTORY_NONE);
+      }
+      else
+        break;
+    }
+
+    prompt = savedPrompt;
+    cursor = line.size();
+    return c;
+  }
+
+  // The word under the cursor, as the lexer would cut it: where it starts, the quote it was opened
+  // with if any, and whether it names the command to run.
+  void currentWord(size_t &start, char &quote, bool &command) const
+  {
+    auto isBlank = [](char c)
+    { return c == ' ' or c == '\t'; };
+    auto isOperator = [](char c)
+    { return c == '|' or c == '<' or c == '>' or c == '&'; };
+
+    bool redirect = false;
+    start = cursor;
+    quote = 0;
+    command = true;
+
+    for (size_t i = 0; i < cursor;)
+    {
+      char c = line[i];
+
+      if (isBlank(c))
+      {
+        i++;
+        continue;
+      }
+
+      if (isOperator(c))
+      {
+        if (c == '<' or c == '>')
+          redirect = true;
+        else
+          command = true;
+
+        i++;
+        continue;
+      }
+
+      size_t first = i;
+
+      if (c == '"' or c == '\'')
+      {
+        size_t close = line.find(c, i + 1);
+
+        if (close == std::string::npos or close >= cursor)
+        {
+          start = first;
+          quote = c;
+          break;
+        }
+
+        i = close + 1;
+      }
+      else
+      {
+        while (i < cursor and !isBlank(line[i]) and !isOperator(line[i]) and line[i] != '"' and line[i] != '\'')
+          i++;
+
+        if (i == cursor)
+        {
+          start = first;
+          break;
+        }
+      }
+
+      if (!redirect)
+        command = false;
+
+      redirect = false;
+    }
+
+    command = command and !redirect;
+  }
+
+  void list(const Completions &completions)
+  {
+    size_t widest = 0;
+
+    for (const Completion &candidate : completions.shown)
+      widest = std::max(widest, columns(candidate.name) + candidate.directory);
+
+    size_t perRow = std::max<size_t>(1, width() / (widest + 2));
+    std::string text = "\n";
+
+    for (size_t i = 0; i < completions.shown.size(); i++)
+    {
+      const Completion &candidate = completions.shown[i];
+      text += candidate.name + (candidate.directory ? "/" : "");
+
+      if ((i + 1) % perRow == 0 or i + 1 == completions.shown.size())
+        text += '\n';
+      else
+        text.append(widest + 2 - columns(candidate.name) - candidate.directory, ' ');
+    }
+
+    if (completions.count > completions.shown.size())
+      text += "... and " + std::to_string(completions.count - completions.shown.size()) + " more\n";
+
+    send(text);
+  }
+
+  void complete()
+  {
+    size_t start;
+    char quote;
+    bool command;
+    currentWord(start, quote, command);
+
+    std::string word = line.substr(start + (quote != 0), cursor - start - (quote != 0));
+    Completions completions;
+    size_t replaced;
+    completer.complete(word, command, completions, replaced);
+
+    if (completions.count == 0)
+    {
+      send("\a");
+      return;
+    }
+
+    std::string addition = completions.common.substr(std::min(replaced, completions.common.size()));
+    bool unique = completions.count == 1;
+
+    if (addition.empty() and !unique)
+    {
+      if (listing)
+      {
+        list(completions);
+        listing = false;
+      }
+      else
+      {
+        send("\a");
+        listing = true;
+      }
+
+      return;
+    }
+
+    // A name the lexer would split is typed inside quotes, opened where the word starts.
+    if (!quote and addition.find_first_of(" \t|<>&\"'") != std::string::npos)
+    {
+      quote = addition.find('"') == std::string::npos ? '"' : '\'';
+      line.insert(start, 1, quote);
+      cursor++;
+    }
+
+    insert(addition);
+
+    if (unique and completions.shown[0].directory)
+      insert("/");
+    else if (unique)
+    {
+      if (quote)
+        insert(std::string(1, quote));
+
+      insert(" ");
+    }
+  }
+
+  void enableRawMode(struct termios &raw)
+  {
+    raw = original;
+    raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+    raw.c_cflag |= CS8;
+    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(input, TCSANOW, &raw);
+  }
+
+  // Handles an escape sequence: the arrows, Home, End and Delete, in their CSI and SS3 forms.
+  void escape()
+  {
+    char kind, code;
+
+    if (!next(kind) or (kind != '[' and kind != 'O') or !next(code))
+      return;
+
+    if (code >= '0' and code <= '9')
+    {
+      char end;
+
+      while (next(end) and end >= '0' and end <= '9')
+        ;
+
+      if (code == '3')
+        code = KEY_CTRL('d');
+      else if (code == '1' or code == '7')
+        code = 'H';
+      else if (code == '4' or code == '8')
+        code = 'F';
+    }
+
+    switch (code)
+    {
+    case 'A':
+      older();
+      break;
+    case 'B':
+      newer();
+      break;
+    case 'C':
+      right();
+      break;
+    case 'D':
+      left();
+      break;
+    case 'H':
+      cursor = 0;
+      break;
+    case 'F':
+      cursor = line.size();
+      break;
+    case KEY_CTRL('d'):
+      if (cursor < line.size())
+        erase(cursor, cursor + advance(std::string_view(line).substr(cursor), 1));
+      break;
+    }
+  }
+
+public:
+  LineEditor(int in, int out, History &h, Completer &c) : input(in), output(out), history(h), completer(c) {}
+
+  // Redraws the prompt and the line, e.g. after something else was printed below them.
+  void refresh()
+  {
+    size_t promptColumns = columns(prompt);
+    size_t available = std::max<size_t>(width() > promptColumns + 1 ? width() - promptColumns - 1 : 1, 1);
+    size_t cursorColumn = columns(std::string_view(line).substr(0, cursor));
+    size_t skipped = cursorColumn >= available ? cursorColumn - available + 1 : 0;
+
+    std::string_view shown = std::string_view(line).substr(advance(line, skipped));
+    shown = shown.substr(0, advance(shown, available));
+
+    std::string text = "\r" + prompt;
+    text.append(shown);
+    text += "\x1b[0K\r";
+
+    if (promptColumns + cursorColumn - skipped > 0)
+      text += "\x1b[" + std::to_string(promptColumns + cursorColumn - skipped) + "C";
+
+    send(text);
+  }
+
+  // Reads one line after `text`. `wait` is called whenever no input is at hand and returns once
+  // some is. Returns false when the input ends: ^D on an empty line or a terminal that went away.
+  bool readLine(const std::string &text, std::string &result, std::function<void()> wait)
+  {
+    struct termios raw;
+
+    if (tcgetattr(input, &original) < 0)
+      return false;
+
+    enableRawMode(raw);
+
+    waitForInput = std::move(wait);
+    prompt = text;
+    line.clear();
+    cursor = 0;
+    listing = false;
+    visited.clear();
+    refresh();
+
+    bool done = false, ended = false;
+    char c;
+
+    while (!done and !ended)
+    {
+      if (!next(c))
+      {
+        ended = true;
+        break;
+      }
+
+      if (c == KEY_CTRL('r'))
+        c = reverseSearch();
+
+      if (c != '\t')
+        listing = false;
+
+      switch (c)
+      {
+      case 0:
+        break;
+      case '\r':
+      case '\n':
+        done = true;
+        break;
+      case KEY_CTRL('a'):
+        cursor = 0;
+        break;
+      case KEY_CTRL('e'):
+        cursor = line.size();
+        break;
+      case KEY_CTRL('b'):
+        left();
+        break;
+      case KEY_CTRL('f'):
+        right();
+        break;
+      case KEY_CTRL('p'):
+        older();
+        break;
+      case KEY_CTRL('n'):
+        newer();
+        break;
+      case KEY_CTRL('c'):
+        send("^C\n");
+        line.clear();
+        cursor = 0;
+        visited.clear();
+        break;
+      case KEY_CTRL('d'):
+        if (line.empty())
+          ended = true;
+        else if (cursor < line.size())
+          erase(cursor, cursor + advance(std::string_view(line).substr(cursor), 1));
+        break;
+      case KEY_BACKSPACE:
+      case KEY_CTRL('h'):
+        if (cursor > 0)
+        {
+          size_t end = cursor;
+          left();
+          erase(cursor, end);
+        }
+        break;
+      case KEY_CTRL('k'):
+        line.erase(cursor);
+        break;
+      case KEY_CTRL('u'):
+        erase(0, cursor);
+        break;
+      case KEY_CTRL('w'):
+      {
+        size_t start = cursor;
+
+        while (start > 0 and line[start - 1] == ' ')
+          start--;
+        while (start > 0 and line[start - 1] != ' ')
+          start--;
+
+        erase(start, cursor);
+        break;
+      }
+      case KEY_CTRL('l'):
+        send("\x1b[H\x1b[2J");
+        break;
+      case '\t':
+        complete();
+        break;
+      case KEY_ESCAPE:
+        escape();
+        break;
+      default:
+        if (static_cast<unsigned char>(c) >= ' ')
+        {
+          insert(std::string_view(&c, 1));
+          visited.clear();
+        }
+        break;
+      }
+
+      if (!ended and !done)
+        refresh();
+    }
+
+    if (done)
+    {
+      cursor = line.size();
+      refresh();
+      send("\n");
+      result = line;
+    }
+
+    tcsetattr(input, TCSANOW, &original);
+    waitForInput = nullptr;
+
+    return done;
+  }
+};
+
+#endif
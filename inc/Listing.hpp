@@ -0,0 +1,581 @@
+#ifndef __LISTING_HPP__
+#define __LISTING_HPP__
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <grp.h>
+#include <pwd.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "ThreadPool.hpp"
+
+#define LIST_BUFFER_SIZE (256 * 1024)
+#define LIST_ARENA_BLOCK_SIZE (1024 * 1024)
+#define LIST_STAT_BATCH 4096
+#define LIST_RECENT_SECONDS (180 * 24 * 60 * 60)
+
+// Record layout written by the getdents64 system call.
+struct DirectoryRecord
+{
+  uint64_t inode;
+  int64_t offset;
+  unsigned short length;
+  unsigned char type;
+  char name[];
+};
+
+// Reads a directory with getdents64 into one reusable buffer. The names handed out point into
+// that buffer and stay valid until the next fill().
+class DirectoryStream
+{
+
+private:
+  int fd;
+  std::unique_ptr<char[]> buffer;
+  size_t position;
+  size_t filled;
+  int status;
+
+public:
+  DirectoryStream() : fd(-1), buffer(new char[LIST_BUFFER_SIZE]), position(0), filled(0), status(0) {}
+
+  DirectoryStream(const DirectoryStream &) = delete;
+  DirectoryStream &operator=(const DirectoryStream &) = delete;
+
+  ~DirectoryStream()
+  {
+    close();
+  }
+
+  bool open(const std::string &path)
+  {
+    close();
+    fd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    return fd >= 0;
+  }
+
+  void close()
+  {
+    if (fd >= 0)
+      ::close(fd);
+
+    fd = -1;
+    position = filled = 0;
+    status = 0;
+  }
+
+  int descriptor() const
+  {
+    return fd;
+  }
+
+  // Returns 0 or the errno of the last failed read.
+  int error() const
+  {
+    return status;
+  }
+
+  // Returns false at the end of the directory or on a read error.
+  bool fill()
+  {
+    long count = syscall(SYS_getdents64, fd, buffer.get(), LIST_BUFFER_SIZE);
+
+    position = 0;
+    filled = count > 0 ? count : 0;
+    status = count < 0 ? errno : 0;
+
+    return count > 0;
+  }
+
+  // Returns false once the entries of the current buffer are exhausted. `.` and `..` are skipped
+  // unless `dots` asks for them.
+  bool next(const char *&name, unsigned char &type, bool dots = false)
+  {
+    while (position < filled)
+    {
+      const DirectoryRecord *record = reinterpret_cast<const DirectoryRecord *>(buffer.get() + position);
+      position += record->length;
+
+      if (!dots and record->name[0] == '.' and (record->name[1] == '\0' or (record->name[1] == '.' and record->name[2] == '\0')))
+        continue;
+
+      name = record->name;
+      type = record->type;
+      return true;
+    }
+
+    return false;
+  }
+};
+
+// The first eight bytes of a name as a big-endian integer: comparing keys orders most names
+// without touching the strings, which sit scattered in memory.
+inline uint64_t nameKey(const char *name)
+{
+  uint64_t key = 0;
+  size_t i = 0;
+
+  for (; i < 8 and name[i] != '\0'; i++)
+    key = key << 8 | static_cast<unsigned char>(name[i]);
+
+  return key << (8 * (8 - i));
+}
+
+// Every entry of a directory, sorted by name: the names packed one after the other, each ending in
+// a NUL, with their offsets and d_types in order. Hidden names are kept.
+struct DirectoryEntries
+{
+  std::vector<char> names;
+  std::vector<uint32_t> offsets;
+  std::vector<unsigned char> types;
+
+  size_t size() const
+  {
+    return offsets.size();
+  }
+
+  const char *name(size_t i) const
+  {
+    return names.data() + offsets[i];
+  }
+
+  // Reads the directory `stream` has open. Returns 0 or the errno that stopped the read.
+  int read(DirectoryStream &stream)
+  {
+    struct Unsorted
+    {
+      uint64_t key;
+      uint32_t offset;
+      unsigned char type;
+    };
+
+    std::vector<Unsorted> unsorted;
+    const char *name;
+    unsigned char type;
+
+    names.clear();
+
+    while (stream.fill())
+      while (stream.next(name, type))
+      {
+        size_t length = strlen(name) + 1;
+        size_t offset = names.size();
+
+        unsorted.push_back({nameKey(name), static_cast<uint32_t>(offset), type});
+        names.resize(offset + length);
+        memcpy(names.data() + offset, name, length);
+      }
+
+    std::sort(unsorted.begin(), unsorted.end(), [this](const Unsorted &a, const Unsorted &b)
+              { return a.key != b.key ? a.key < b.key : strcmp(names.data() + a.offset, names.data() + b.offset) < 0; });
+
+    offsets.resize(unsorted.size());
+    types.resize(unsorted.size());
+
+    for (size_t i = 0; i < unsorted.size(); i++)
+    {
+      offsets[i] = unsorted[i].offset;
+      types[i] = unsorted[i].type;
+    }
+
+    return stream.error();
+  }
+};
+
+// Bump allocator for names: one allocation per block instead of one per entry.
+class NameArena
+{
+
+private:
+  std::vector<std::unique_ptr<char[]>> blocks;
+  size_t used;
+  size_t capacity;
+
+public:
+  NameArena() : used(0), capacity(0) {}
+
+  const char *store(const char *name)
+  {
+    size_t size = strlen(name) + 1;
+
+    if (used + size > capacity)
+    {
+      capacity = std::max<size_t>(size, LIST_ARENA_BLOCK_SIZE);
+      blocks.emplace_back(new char[capacity]);
+      used = 0;
+    }
+
+    char *copy = blocks.back().get() + used;
+    memcpy(copy, name, size);
+    used += size;
+
+    return copy;
+  }
+
+  // Keeps the first block for the next listing.
+  void clear()
+  {
+    if (blocks.size() > 1)
+      blocks.resize(1);
+
+    used = 0;
+    capacity = blocks.empty() ? 0 : LIST_ARENA_BLOCK_SIZE;
+  }
+};
+
+// Users and groups resolved once per id; a lookup through NSS can cost a file read each time.
+class IdentityCache
+{
+
+private:
+  std::unordered_map<uid_t, std::string> users;
+  std::unordered_map<gid_t, std::string> groups;
+
+public:
+  const std::string &user(uid_t uid)
+  {
+    auto cached = users.find(uid);
+
+    if (cached != users.end())
+      return cached->second;
+
+    char buffer[4096];
+    struct passwd entry, *result = nullptr;
+    getpwuid_r(uid, &entry, buffer, sizeof(buffer), &result);
+
+    return users.emplace(uid, result ? result->pw_name : std::to_string(uid)).first->second;
+  }
+
+  const std::string &group(gid_t gid)
+  {
+    auto cached = groups.find(gid);
+
+    if (cached != groups.end())
+      return cached->second;
+
+    char buffer[4096];
+    struct group entry, *result = nullptr;
+    getgrgid_r(gid, &entry, buffer, sizeof(buffer), &result);
+
+    return groups.emplace(gid, result ? result->gr_name : std::to_string(gid)).first->second;
+  }
+};
+
+struct ListEntry
+{
+  uint64_t key;
+  const char *name;
+  unsigned char type;
+  bool stated;
+  uint16_t mode;
+  uint32_t links;
+  uint32_t uid;
+  uint32_t gid;
+  uint64_t size;
+  int64_t mtime;
+};
+
+// Lists one directory. Sorted listings keep the names in an arena and sort pointers with strcmp;
+// unsorted ones go out a getdents64 buffer at a time, so memory stays constant. The long format
+// fetches metadata with statx, spread over the pool in batches.
+class DirectoryLister
+{
+
+private:
+  DirectoryStream stream;
+  NameArena arena;
+  IdentityCache identities;
+  std::vector<ListEntry> entries;
+  std::string line;
+
+  static void statRange(int fd, ListEntry *first, ListEntry *last)
+  {
+    const unsigned int mask = STATX_MODE | STATX_NLINK | STATX_UID | STATX_GID | STATX_SIZE | STATX_MTIME;
+
+    for (ListEntry *entry = first; entry != last; entry++)
+    {
+      struct statx info;
+
+      entry->stated = statx(fd, entry->name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, mask, &info) == 0;
+
+      if (!entry->stated)
+        continue;
+
+      entry->mode = info.stx_mode;
+      entry->links = info.stx_nlink;
+      entry->uid = info.stx_uid;
+      entry->gid = info.stx_gid;
+      entry->size = info.stx_size;
+      entry->mtime = info.stx_mtime.tv_sec;
+    }
+  }
+
+  void statAll(ThreadPool &pool)
+  {
+    int fd = stream.descriptor();
+
+    if (entries.size() <= LIST_STAT_BATCH)
+    {
+      statRange(fd, entries.data(), entries.data() + entries.size());
+      return;
+    }
+
+    for (size_t first = 0; first < entries.size(); first += LIST_STAT_BATCH)
+    {
+      ListEntry *begin = entries.data() + first;
+      ListEntry *end = entries.data() + std::min(entries.size(), first + LIST_STAT_BATCH);
+
+      pool.submit([fd, begin, end]
+                  { statRange(fd, begin, end); });
+    }
+
+    pool.wait();
+  }
+
+  static char typeOf(uint16_t mode)
+  {
+    switch (mode & S_IFMT)
+    {
+    case S_IFDIR:
+      return 'd';
+    case S_IFLNK:
+      return 'l';
+    case S_IFCHR:
+      return 'c';
+    case S_IFBLK:
+      return 'b';
+    case S_IFIFO:
+      return 'p';
+    case S_IFSOCK:
+      return 's';
+    default:
+      return '-';
+    }
+  }
+
+  static size_t digits(uint64_t value)
+  {
+    size_t count = 1;
+
+    while (value >= 10)
+    {
+      value /= 10;
+      count++;
+    }
+
+    return count;
+  }
+
+  static void pad(std::string &out, std::string_view text, size_t width, bool right)
+  {
+    if (right)
+      out.append(width - std::min(width, text.size()), ' ');
+
+    out.append(text);
+
+    if (!right)
+      out.append(width - std::min(width, text.size()), ' ');
+  }
+
+  static void padNumber(std::string &out, uint64_t value, size_t width)
+  {
+    char text[20];
+    char *start = text + sizeof(text);
+
+    do
+    {
+      *--start = '0' + value % 10;
+      value /= 10;
+    } while (value > 0);
+
+    pad(out, std::string_view(start, text + sizeof(text) - start), width, true);
+  }
+
+  template <typename Output>
+  void printLong(Output &output)
+  {
+    size_t linksWidth = 1, userWidth = 1, groupWidth = 1, sizeWidth = 1;
+
+    for (const ListEntry &entry : entries)
+    {
+      if (!entry.stated)
+        continue;
+
+      linksWidth = std::max(linksWidth, digits(entry.links));
+      userWidth = std::max(userWidth, identities.user(entry.uid).size());
+      groupWidth = std::max(groupWidth, identities.group(entry.gid).size());
+      sizeWidth = std::max(sizeWidth, digits(entry.size));
+    }
+
+    time_t now = time(nullptr), lastTime = -1;
+    char date[32];
+
+    for (const ListEntry &entry : entries)
+    {
+      line.clear();
+
+      if (!entry.stated)
+      {
+        line.append("?????????? ").append(entry.name);
+        output(line);
+        continue;
+      }
+
+      const char permissions[] = {
+          typeOf(entry.mode),
+          entry.mode & S_IRUSR ? 'r' : '-',
+          entry.mode & S_IWUSR ? 'w' : '-',
+          entry.mode & S_ISUID ? (entry.mode & S_IXUSR ? 's' : 'S') : (entry.mode & S_IXUSR ? 'x' : '-'),
+          entry.mode & S_IRGRP ? 'r' : '-',
+          entry.mode & S_IWGRP ? 'w' : '-',
+          entry.mode & S_ISGID ? (entry.mode & S_IXGRP ? 's' : 'S') : (entry.mode & S_IXGRP ? 'x' : '-'),
+          entry.mode & S_IROTH ? 'r' : '-',
+          entry.mode & S_IWOTH ? 'w' : '-',
+          entry.mode & S_ISVTX ? (entry.mode & S_IXOTH ? 't' : 'T') : (entry.mode & S_IXOTH ? 'x' : '-')};
+
+      time_t mtime = entry.mtime;
+
+      if (mtime != lastTime)
+      {
+        struct tm local;
+
+        localtime_r(&mtime, &local);
+        strftime(date, sizeof(date), now - mtime < LIST_RECENT_SECONDS and mtime <= now ? "%b %e %H:%M" : "%b %e  %Y", &local);
+        lastTime = mtime;
+      }
+
+      line.append(permissions, sizeof(permissions)).push_back(' ');
+      padNumber(line, entry.links, linksWidth);
+      line.push_back(' ');
+      pad(line, identities.user(entry.uid), userWidth, false);
+      line.push_back(' ');
+      pad(line, identities.group(entry.gid), groupWidth, false);
+      line.push_back(' ');
+      padNumber(line, entry.size, sizeWidth);
+      line.append(" ").append(date).append(" ").append(entry.name);
+
+      if (S_ISLNK(entry.mode))
+      {
+        char target[PATH_MAX];
+        ssize_t length = readlinkat(stream.descriptor(), entry.name, target, sizeof(target));
+
+        if (length > 0)
+          line.append(" -> ").append(target, length);
+      }
+
+      output(line);
+    }
+  }
+
+  template <typename Output>
+  void print(bool longFormat, ThreadPool &pool, Output &output)
+  {
+    if (longFormat)
+    {
+      statAll(pool);
+      printLong(output);
+      return;
+    }
+
+    for (const ListEntry &entry : entries)
+    {
+      line.assign(entry.name).push_back('\t');
+      output(line);
+    }
+  }
+
+public:
+  // Calls `output` once per formatted piece: a full line in the long format, a name followed by a
+  // tab otherwise. Returns 0 or the errno that stopped the listing.
+  template <typename Output>
+  int list(const std::string &path, bool all, bool longFormat, bool unsorted, ThreadPool &pool, Output output)
+  {
+    if (!stream.open(path))
+      return errno;
+
+    const char *name;
+    unsigned char type;
+
+    entries.clear();
+    arena.clear();
+
+    while (stream.fill())
+    {
+      while (stream.next(name, type, all))
+        if (all or name[0] != '.')
+          entries.push_back({unsorted ? 0 : nameKey(name), unsorted ? name : arena.store(name), type, false, 0, 0, 0, 0, 0, 0});
+
+      if (unsorted)
+      {
+        print(longFormat, pool, output);
+        entries.clear();
+      }
+    }
+
+    int error = stream.error();
+
+    if (!unsorted)
+    {
+      std::sort(entries.begin(), entries.end(), [](const ListEntry &a, const ListEntry &b)
+                { return a.key != b.key ? a.key < b.key : strcmp(a.name, b.name) < 0; });
+
+      print(longFormat, pool, output);
+    }
+
+    entries.clear();
+    entries.shrink_to_fit();
+    stream.close();
+
+    return error;
+  }
+
+  // Lists entries read earlier, already sorted; the directory is only opened again for the long
+  // format, whose metadata is never cached. The cache holds no `.` and `..`, so they are merged
+  // into their places when hidden names are listed.
+  template <typename Output>
+  int list(const DirectoryEntries &cached, const std::string &path, bool all, bool longFormat, ThreadPool &pool, Output output)
+  {
+    if (longFormat and !stream.open(path))
+      return errno;
+
+    static const char *const dots[] = {".", ".."};
+    size_t dot = all ? 0 : 2;
+
+    entries.clear();
+    entries.reserve(cached.size() + 2);
+
+    for (size_t i = 0; i < cached.size(); i++)
+    {
+      for (; dot < 2 and strcmp(dots[dot], cached.name(i)) < 0; dot++)
+        entries.push_back({0, dots[dot], DT_DIR, false, 0, 0, 0, 0, 0, 0});
+
+      if (all or cached.name(i)[0] != '.')
+        entries.push_back({0, cached.name(i), cached.types[i], false, 0, 0, 0, 0, 0, 0});
+    }
+
+    for (; dot < 2; dot++)
+      entries.push_back({0, dots[dot], DT_DIR, false, 0, 0, 0, 0, 0, 0});
+
+    print(longFormat, pool, output);
+
+    entries.clear();
+    entries.shrink_to_fit();
+    stream.close();
+
+    return 0;
+  }
+};
+
+#endif
@@ -0,0 +1,262 @@
+#ifndef __MAKE_DIRECTORY_HPP__
+#define __MAKE_DIRECTORY_HPP__
+
+#include <algorithm>
+#include <cerrno>
+#include <list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "ThreadPool.hpp"
+
+#define DIRECTORY_CACHE_SIZE 64
+#define MKDIR_PARALLEL_THRESHOLD 4096
+#define MKDIR_CHUNKS_PER_WORKER 4
+#define MKDIR_MODE (S_IRWXU | S_IRWXG | S_IRWXO)
+
+// Creates paths one after another like `mkdir -p`, with mkdirat relative to descriptors of the
+// parents it has already been through. The most recently used ones stay open, so a list of siblings
+// or of paths sharing a long prefix walks that prefix only once. Lives for one batch: a descriptor
+// kept across commands could outlive the directory it points to.
+class DirectoryCache
+{
+
+private:
+  struct Entry
+  {
+    int fd;
+    std::list<std::string>::iterator use;
+  };
+
+  std::unordered_map<std::string, Entry> entries;
+  std::list<std::string> recent;
+
+  int lookup(const std::string &path)
+  {
+    auto entry = entries.find(path);
+
+    if (entry == entries.end())
+      return -1;
+
+    recent.splice(recent.begin(), recent, entry->second.use);
+    return entry->second.fd;
+  }
+
+  void remember(const std::string &path, int fd)
+  {
+    if (entries.size() == DIRECTORY_CACHE_SIZE)
+    {
+      auto oldest = entries.find(recent.back());
+      close(oldest->second.fd);
+      entries.erase(oldest);
+      recent.pop_back();
+    }
+
+    recent.push_front(path);
+    entries[path] = {fd, recent.begin()};
+  }
+
+public:
+  DirectoryCache() = default;
+  DirectoryCache(const DirectoryCache &) = delete;
+  DirectoryCache &operator=(const DirectoryCache &) = delete;
+
+  // Creates every missing directory of `path`. Returns 0 when the last one was created, or the
+  // errno that stopped it: EEXIST when the last one was already there.
+  int create(std::string_view path)
+  {
+    std::string prefix = path.substr(0, 1) == "/" ? "/" : "";
+    std::vector<std::string_view> names;
+    std::vector<size_t> ends;
+
+    for (size_t start = 0; start < path.size();)
+    {
+      size_t slash = std::min(path.find('/', start), path.size());
+      std::string_view name = path.substr(start, slash - start);
+
+      if (!name.empty() and name != ".")
+      {
+        prefix += (prefix.empty() or prefix == "/" ? "" : "/") + std::string(name);
+        names.push_back(name);
+        ends.push_back(prefix.size());
+      }
+
+      start = slash + 1;
+    }
+
+    if (names.empty())
+      return EEXIST;
+
+    int fd = path[0] == '/' ? -1 : AT_FDCWD;
+    size_t next = 0;
+
+    for (size_t known = names.size() - 1; known > 0; known--)
+    {
+      int cached = lookup(prefix.substr(0, ends[known - 1]));
+
+      if (cached >= 0)
+      {
+        fd = cached;
+        next = known;
+        break;
+      }
+    }
+
+    if (fd == -1)
+    {
+      fd = lookup("/");
+
+      if (fd < 0)
+      {
+        fd = open("/", O_PATH | O_DIRECTORY | O_CLOEXEC);
+
+        if (fd < 0)
+          return errno;
+
+        remember("/", fd);
+      }
+    }
+
+    for (; next < names.size(); next++)
+    {
+      std::string name(names[next]);
+      int status = mkdirat(fd, name.c_str(), MKDIR_MODE);
+
+      if (next + 1 == names.size())
+        return status == 0 ? 0 : errno;
+
+      if (status < 0 and errno != EEXIST)
+        return errno;
+
+      int child = openat(fd, name.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+
+      if (child < 0)
+        return errno;
+
+      remember(prefix.substr(0, ends[next]), child);
+      fd = child;
+    }
+
+    return 0;
+  }
+
+  ~DirectoryCache()
+  {
+    for (auto &[path, entry] : entries)
+      close(entry.fd);
+  }
+};
+
+// Creates a list of paths. A long list is sorted so that each directory is followed by everything
+// listed under it, cut into subtrees, and the subtrees are created in parallel on the pool, each
+// batch with a cache of its own.
+class DirectoryMaker
+{
+
+private:
+  ThreadPool &pool;
+
+  // Orders paths component by component: '/' sorts before any other byte.
+  static bool precedes(const std::string &a, const std::string &b)
+  {
+    return std::lexicographical_compare(a.begin(), a.end(), b.begin(), b.end(), [](char x, char y)
+                                        { return (x == '/' ? 0 : static_cast<unsigned char>(x) + 1) <
+                                                 (y == '/' ? 0 : static_cast<unsigned char>(y) + 1); });
+  }
+
+  static bool isUnder(const std::string &path, const std::string &ancestor)
+  {
+    return path.size() > ancestor.size() and path[ancestor.size()] == '/' and path.compare(0, ancestor.size(), ancestor) == 0;
+  }
+
+  static std::string normalize(const std::string &path)
+  {
+    std::string result = path.substr(0, 1) == "/" ? "/" : "";
+    size_t start = 0;
+
+    while (start < path.size())
+    {
+      size_t slash = std::min(path.find('/', start), path.size());
+
+      if (slash > start and path.compare(start, slash - start, ".") != 0)
+        result.append(result.empty() or result == "/" ? "" : "/").append(path, start, slash - start);
+
+      start = slash + 1;
+    }
+
+    return result;
+  }
+
+public:
+  explicit DirectoryMaker(ThreadPool &p) : pool(p) {}
+
+  // Fills `results` with what DirectoryCache::create returned for each path, in the list's order.
+  void createAll(const std::vector<std::string> &paths, std::vector<int> &results)
+  {
+    results.assign(paths.size(), 0);
+
+    if (paths.size() < MKDIR_PARALLEL_THRESHOLD)
+    {
+      DirectoryCache cache;
+
+      for (size_t i = 0; i < paths.size(); i++)
+        results[i] = cache.create(paths[i]);
+
+      return;
+    }
+
+    std::vector<std::string> normalized(paths.size());
+    std::vector<size_t> order(paths.size());
+
+    for (size_t i = 0; i < paths.size(); i++)
+    {
+      normalized[i] = normalize(paths[i]);
+      order[i] = i;
+    }
+
+    std::stable_sort(order.begin(), order.end(), [&normalized](size_t a, size_t b)
+                     { return precedes(normalized[a], normalized[b]); });
+
+    // A batch may only end before a path none of whose ancestors is listed: everything listed
+    // under a directory then goes to the batch that creates it.
+    size_t target = std::max<size_t>(paths.size() / (pool.size() * MKDIR_CHUNKS_PER_WORKER), 1);
+    std::vector<size_t> ancestors;
+    size_t first = 0;
+
+    auto submit = [this, &paths, &results, &order](size_t begin, size_t end)
+    {
+      pool.submit([&paths, &results, &order, begin, end]
+                  {
+                    DirectoryCache cache;
+
+                    for (size_t i = begin; i < end; i++)
+                      results[order[i]] = cache.create(paths[order[i]]); });
+    };
+
+    for (size_t i = 0; i < order.size(); i++)
+    {
+      const std::string &path = normalized[order[i]];
+
+      while (!ancestors.empty() and !isUnder(path, normalized[order[ancestors.back()]]))
+        ancestors.pop_back();
+
+      if (ancestors.empty() and i - first >= target)
+      {
+        submit(first, i);
+        first = i;
+      }
+
+      ancestors.push_back(i);
+    }
+
+    submit(first, order.size());
+    pool.wait();
+  }
+};
+
+#endif
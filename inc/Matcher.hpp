@@ -0,0 +1,72 @@
+#ifndef __MATCHER_HPP__
+#define __MATCHER_HPP__
+
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+#include "Search.hpp"
+#include "AhoCorasick.hpp"
+#include "Regex.hpp"
+
+// What grep looks for: one literal, searched with the SIMD kernels, a set of literals, searched in
+// a single pass by an Aho-Corasick automaton, or an extended regular expression. A matcher is built once and only read
+// afterwards, so the workers of a recursive grep can share it.
+class Matcher
+{
+
+private:
+  std::variant<Searcher, AhoCorasick, Regex> engine;
+
+  Matcher(std::in_place_type_t<Regex> regex, const std::string &expression) : engine(regex, expression) {}
+
+public:
+  explicit Matcher(const std::string &pattern) : engine(std::in_place_type<Searcher>, pattern) {}
+
+  explicit Matcher(const std::vector<std::string> &patterns) : engine(std::in_place_type<AhoCorasick>, patterns) {}
+
+  // A pattern is a literal unless it is asked for as an extended regular expression.
+  static Matcher extended(const std::string &expression)
+  {
+    return Matcher(std::in_place_type<Regex>, expression);
+  }
+
+  // False only for a regular expression that does not parse.
+  bool isValid() const
+  {
+    const Regex *regex = std::get_if<Regex>(&engine);
+    return regex == nullptr or regex->isValid();
+  }
+
+  // `begin` must start a line, as the blocks handed out by scanLines do.
+  const char *find(const char *begin, const char *end) const
+  {
+    if (const Searcher *searcher = std::get_if<Searcher>(&engine))
+      return searcher->find(begin, end);
+
+    if (const Regex *regex = std::get_if<Regex>(&engine))
+      return regex->find(begin, end);
+
+    return std::get<AhoCorasick>(engine).find(begin, end);
+  }
+
+  // The pattern a matching line is reported under; empty when there is a single pattern.
+  std::string_view label(std::string_view line) const
+  {
+    const AhoCorasick *automaton = std::get_if<AhoCorasick>(&engine);
+
+    if (automaton == nullptr)
+      return std::string_view();
+
+    size_t id = automaton->match(line.data(), line.data() + line.size());
+    return id == AHO_CORASICK_NO_MATCH ? std::string_view() : automaton->getPattern(id);
+  }
+
+  bool isLabelled() const
+  {
+    return std::holds_alternative<AhoCorasick>(engine);
+  }
+};
+
+#endif
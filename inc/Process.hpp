@@ -0,0 +1,244 @@
+#ifndef __PROCESS_HPP__
+#define __PROCESS_HPP__
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <unordered_map>
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "Utils.hpp"
+
+extern char **environ;
+
+#define PATH_REVALIDATE_INTERVAL std::chrono::seconds(1)
+
+// In-memory index of the executables reachable through $PATH. A directory is rescanned only
+// when its mtime changes, and the mtimes are checked at most once per interval or after a miss.
+class PathIndex
+{
+
+private:
+  struct Directory
+  {
+    std::string path;
+    struct timespec mtime;
+    std::vector<std::string> names;
+  };
+
+  std::string pathVariable;
+  std::vector<Directory> directories;
+  std::unordered_map<std::string, std::string> executables;
+  std::vector<std::string> sortedNames;
+  std::chrono::steady_clock::time_point lastCheck;
+
+  static bool sameTime(const struct timespec &a, const struct timespec &b)
+  {
+    return a.tv_sec == b.tv_sec and a.tv_nsec == b.tv_nsec;
+  }
+
+  static void scan(Directory &directory)
+  {
+    directory.names.clear();
+
+    DIR *dir = opendir(directory.path.c_str());
+
+    if (dir == nullptr)
+      return;
+
+    dirent *d;
+
+    while ((d = readdir(dir)) != nullptr)
+    {
+      if (d->d_type != DT_REG and d->d_type != DT_LNK and d->d_type != DT_UNKNOWN)
+        continue;
+
+      if (faccessat(dirfd(dir), d->d_name, X_OK, 0) == 0)
+        directory.names.emplace_back(d->d_name);
+    }
+
+    closedir(dir);
+  }
+
+  void merge()
+  {
+    executables.clear();
+
+    for (const Directory &directory : directories)
+      for (const std::string &name : directory.names)
+        executables.emplace(name, directory.path + "/" + name);
+
+    sortedNames.clear();
+    sortedNames.reserve(executables.size());
+
+    for (const auto &[name, path] : executables)
+      sortedNames.push_back(name);
+
+    std::sort(sortedNames.begin(), sortedNames.end());
+  }
+
+  void reload(const char *path)
+  {
+    pathVariable = path;
+    directories.clear();
+
+    for (const std::string &entry : split(pathVariable, ':'))
+    {
+      Directory directory{entry.empty() ? "." : entry, {0, 0}, {}};
+      struct stat sb;
+
+      if (stat(directory.path.c_str(), &sb) == 0)
+        directory.mtime = sb.st_mtim;
+
+      scan(directory);
+      directories.push_back(std::move(directory));
+    }
+
+    merge();
+  }
+
+  bool revalidate()
+  {
+    const char *path = std::getenv("PATH");
+    path = path ? path : "/usr/local/bin:/usr/bin:/bin";
+
+    lastCheck = std::chrono::steady_clock::now();
+
+    if (pathVariable != path)
+    {
+      reload(path);
+      return true;
+    }
+
+    bool changed = false;
+
+    for (Directory &directory : directories)
+    {
+      struct stat sb;
+      struct timespec mtime = {0, 0};
+
+      if (stat(directory.path.c_str(), &sb) == 0)
+        mtime = sb.st_mtim;
+
+      if (!sameTime(mtime, directory.mtime))
+      {
+        directory.mtime = mtime;
+        scan(directory);
+        changed = true;
+      }
+    }
+
+    if (changed)
+      merge();
+
+    return changed;
+  }
+
+public:
+  PathIndex() : pathVariable("\n") {}
+
+  std::string lookup(std::string_view name)
+  {
+    if (name.find('/') != std::string_view::npos)
+      return std::string(name);
+
+    bool expired = std::chrono::steady_clock::now() - lastCheck >= PATH_REVALIDATE_INTERVAL;
+
+    if (expired)
+      revalidate();
+
+    auto executable = executables.find(std::string(name));
+
+    if (executable == executables.end() and !expired and revalidate())
+      executable = executables.find(std::string(name));
+
+    return executable == executables.end() ? "" : executable->second;
+  }
+
+  // Appends the names of the executables that start with `prefix`, in order.
+  void complete(std::string_view prefix, std::vector<std::string> &names)
+  {
+    if (std::chrono::steady_clock::now() - lastCheck >= PATH_REVALIDATE_INTERVAL)
+      revalidate();
+
+    for (auto name = std::lower_bound(sortedNames.begin(), sortedNames.end(), prefix);
+         name != sortedNames.end() and name->compare(0, prefix.size(), prefix) == 0; name++)
+      names.push_back(*name);
+  }
+};
+
+// Starts `path` with posix_spawn, which uses vfork semantics, so the cost does not depend on
+// the size of the shell's heap. A descriptor of -1 keeps the shell's own stdin or stdout. The
+// program starts with no blocked signals and with the job-control signals the shell ignores
+// back at their defaults. With a `terminal`, it leads a process group of its own and takes that
+// terminal before it runs, so it cannot read from it too early and be stopped.
+inline pid_t spawnProcess(const std::string &path, const std::vector<std::string> &args, int inputFd = -1, int outputFd = -1, int terminal = -1)
+{
+  std::vector<char *> argv;
+
+  for (const std::string &arg : args)
+    argv.push_back(const_cast<char *>(arg.c_str()));
+
+  argv.push_back(nullptr);
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+
+  if (inputFd >= 0 and inputFd != STDIN_FILENO)
+    posix_spawn_file_actions_adddup2(&actions, inputFd, STDIN_FILENO);
+
+  if (outputFd >= 0 and outputFd != STDOUT_FILENO)
+    posix_spawn_file_actions_adddup2(&actions, outputFd, STDOUT_FILENO);
+
+  posix_spawnattr_t attributes;
+  posix_spawnattr_init(&attributes);
+
+  sigset_t signals;
+  sigemptyset(&signals);
+  posix_spawnattr_setsigmask(&attributes, &signals);
+
+  sigset_t defaults;
+  sigemptyset(&defaults);
+  sigaddset(&defaults, SIGTSTP);
+  sigaddset(&defaults, SIGTTIN);
+  sigaddset(&defaults, SIGTTOU);
+  posix_spawnattr_setsigdefault(&attributes, &defaults);
+
+  short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+
+  if (terminal >= 0)
+  {
+    posix_spawnattr_setpgroup(&attributes, 0);
+    flags |= POSIX_SPAWN_SETPGROUP;
+
+#if defined(__GLIBC__) and (__GLIBC__ > 2 or __GLIBC_MINOR__ >= 35)
+    posix_spawn_file_actions_addtcsetpgrp_np(&actions, terminal);
+#endif
+  }
+
+  posix_spawnattr_setflags(&attributes, flags);
+
+  pid_t pid;
+  int error = posix_spawn(&pid, path.c_str(), &actions, &attributes, argv.data(), environ);
+
+  posix_spawnattr_destroy(&attributes);
+  posix_spawn_file_actions_destroy(&actions);
+
+  if (error != 0)
+    return -1;
+
+  if (terminal >= 0)
+    tcsetpgrp(terminal, pid);
+
+  return pid;
+}
+
+#endif
@@ -0,0 +1,943 @@
+#ifndef __REGEX_HPP__
+#define __REGEX_HPP__
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "Search.hpp"
+
+#define REGEX_MAX_REPEAT 1000
+#define REGEX_MAX_STATES 100000
+// Parsing, compiling and literal extraction all recurse over the syntax tree, so its height is bounded.
+#define REGEX_MAX_DEPTH 1000
+#define REGEX_DFA_MAX_STATES 4096
+
+using ByteSet = std::bitset<256>;
+
+// POSIX extended regular expressions, matched line by line in time linear in the input. The
+// pattern becomes a Thompson NFA; searches run on a DFA built lazily from it, one state per set
+// of NFA states actually reached. When the DFA outgrows its budget the search goes on by simulating
+// the NFA directly, which is slower but still linear. A literal every match must contain is
+// looked for first with the SIMD searcher, and only the lines holding it are run through the
+// automaton.
+class Regex
+{
+
+private:
+  enum NodeKind
+  {
+    NODE_EMPTY,
+    NODE_BYTES,
+    NODE_CONCAT,
+    NODE_ALTERNATE,
+    NODE_REPEAT,
+    NODE_BOL,
+    NODE_EOL
+  };
+
+  struct Node
+  {
+    NodeKind kind;
+    ByteSet bytes;
+    std::vector<int> children;
+    int min;
+    int max;
+    int height;
+  };
+
+  enum StateType
+  {
+    STATE_BYTES,
+    STATE_EPSILON,
+    STATE_SPLIT,
+    STATE_BOL,
+    STATE_EOL,
+    STATE_MATCH
+  };
+
+  struct State
+  {
+    StateType type;
+    ByteSet bytes;
+    int out;
+    int out1;
+  };
+
+  struct Fragment
+  {
+    int start;
+    std::vector<std::pair<int, int>> outs;
+  };
+
+  struct DfaState
+  {
+    std::vector<int> set;
+    bool match;
+    bool matchAtEol;
+  };
+
+  struct SetHash
+  {
+    size_t operator()(const std::vector<int> &set) const
+    {
+      size_t hash = 14695981039346656037ull;
+
+      for (int state : set)
+        hash = (hash ^ static_cast<size_t>(state)) * 1099511628211ull;
+
+      return hash;
+    }
+  };
+
+  // The lazily built DFA and the scratch space of one searching thread.
+  struct Dfa
+  {
+    std::vector<DfaState> states;
+    std::vector<int32_t> transitions;
+    std::vector<uint8_t> accepting;
+    int initial = -1;
+    std::unordered_map<std::vector<int>, int, SetHash> index;
+    std::vector<uint32_t> marks;
+    uint32_t generation = 0;
+    std::vector<int> stack;
+    std::vector<int> set;
+  };
+
+  struct DfaPool
+  {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Dfa>> idle;
+  };
+
+  std::string pattern;
+  size_t position;
+  std::string error;
+  int nesting;
+  std::vector<Node> nodes;
+  std::vector<State> states;
+  int start;
+  std::array<uint16_t, 256> classes;
+  std::vector<unsigned char> representatives;
+  std::string literal;
+  bool exact;
+  std::unique_ptr<Searcher> prefilter;
+  std::unique_ptr<DfaPool> pool;
+
+  int addNode(NodeKind kind, const ByteSet &bytes = ByteSet(), std::vector<int> children = {}, int min = 0, int max = 0)
+  {
+    int height = 1;
+
+    for (int child : children)
+      if (child >= 0)
+        height = std::max(height, nodes[child].height + 1);
+
+    if (height > REGEX_MAX_DEPTH and error.empty())
+      error = "pattern nested too deeply";
+
+    nodes.push_back({kind, bytes, std::move(children), min, max, height});
+    return nodes.size() - 1;
+  }
+
+  bool more() const
+  {
+    return error.empty() and position < pattern.size();
+  }
+
+  static ByteSet namedClass(const std::string &name)
+  {
+    ByteSet set;
+
+    for (int c = 0; c < 256; c++)
+    {
+      bool member = name == "alpha"   ? isalpha(c)
+                    : name == "digit" ? isdigit(c)
+                    : name == "alnum" ? isalnum(c)
+                    : name == "space" ? isspace(c)
+                    : name == "upper" ? isupper(c)
+                    : name == "lower" ? islower(c)
+                    : name == "xdigit" ? isxdigit(c)
+                    : name == "punct" ? ispunct(c)
+                                      : false;
+      set[c] = c < 128 and member;
+    }
+
+    return set;
+  }
+
+  // \d, \w and \s, their complements, or an escaped byte standing for itself.
+  static ByteSet escaped(char c)
+  {
+    ByteSet set;
+
+    switch (c)
+    {
+    case 'd':
+    case 'D':
+      set = namedClass("digit");
+      break;
+    case 'w':
+    case 'W':
+      set = namedClass("alnum");
+      set['_'] = true;
+      break;
+    case 's':
+    case 'S':
+      set = namedClass("space");
+      break;
+    case 't':
+      set['\t'] = true;
+      return set;
+    default:
+      set[static_cast<unsigned char>(c)] = true;
+      return set;
+    }
+
+    if (isupper(c))
+    {
+      set.flip();
+      set['\n'] = false;
+    }
+
+    return set;
+  }
+
+  int parseClass()
+  {
+    ByteSet set;
+    bool negate = position < pattern.size() and pattern[position] == '^';
+    bool first = true;
+
+    position += negate;
+
+    while (position < pattern.size() and (first or pattern[position] != ']'))
+    {
+      first = false;
+      unsigned char low = pattern[position++];
+
+      if (low == '[' and position < pattern.size() and pattern[position] == ':')
+      {
+        size_t close = pattern.find(":]", position + 1);
+
+        if (close == std::string::npos)
+          break;
+
+        ByteSet named = namedClass(pattern.substr(position + 1, close - position - 1));
+
+        if (named.none())
+        {
+          error = "unknown character class";
+          return -1;
+        }
+
+        set |= named;
+        position = close + 2;
+        continue;
+      }
+
+      if (low == '\\' and position < pattern.size())
+      {
+        set |= escaped(pattern[position++]);
+        continue;
+      }
+
+      unsigned char high = low;
+
+      if (position + 1 < pattern.size() and pattern[position] == '-' and pattern[position + 1] != ']')
+      {
+        high = pattern[position + 1];
+        position += 2;
+
+        if (high < low)
+        {
+          error = "invalid range";
+          return -1;
+        }
+      }
+
+      for (int c = low; c <= high; c++)
+        set[c] = true;
+    }
+
+    if (position >= pattern.size())
+    {
+      error = "unterminated bracket expression";
+      return -1;
+    }
+
+    position++;
+
+    if (negate)
+    {
+      set.flip();
+      set['\n'] = false;
+    }
+
+    return addNode(NODE_BYTES, set);
+  }
+
+  int parseAtom()
+  {
+    char c = pattern[position++];
+    ByteSet set;
+
+    switch (c)
+    {
+    case '(':
+    {
+      if (nesting == REGEX_MAX_DEPTH)
+      {
+        error = "pattern nested too deeply";
+        return -1;
+      }
+
+      nesting++;
+      int inner = parseAlternation();
+      nesting--;
+
+      if (error.empty() and (position >= pattern.size() or pattern[position] != ')'))
+        error = "unmatched parenthesis";
+
+      position++;
+      return inner;
+    }
+
+    case '[':
+      return parseClass();
+
+    case '.':
+      set.set();
+      set['\n'] = false;
+      return addNode(NODE_BYTES, set);
+
+    case '^':
+      return addNode(NODE_BOL);
+
+    case '$':
+      return addNode(NODE_EOL);
+
+    case '\\':
+      if (position >= pattern.size())
+      {
+        error = "trailing backslash";
+        return -1;
+      }
+
+      return addNode(NODE_BYTES, escaped(pattern[position++]));
+
+    case '*':
+    case '+':
+    case '?':
+    case '{':
+      error = "nothing to repeat";
+      return -1;
+
+    default:
+      set[static_cast<unsigned char>(c)] = true;
+      return addNode(NODE_BYTES, set);
+    }
+  }
+
+  bool parseBound(int &min, int &max)
+  {
+    size_t close = pattern.find('}', position);
+
+    if (close == std::string::npos)
+      return false;
+
+    std::string bounds = pattern.substr(position, close - position);
+    size_t comma = bounds.find(',');
+    char *end;
+
+    min = strtol(bounds.c_str(), &end, 10);
+
+    if (end == bounds.c_str() or (comma == std::string::npos ? *end != '\0' : end != bounds.c_str() + comma))
+      return false;
+
+    max = min;
+
+    if (comma != std::string::npos)
+    {
+      max = comma + 1 == bounds.size() ? -1 : strtol(bounds.c_str() + comma + 1, &end, 10);
+
+      if (max >= 0 and *end != '\0')
+        return false;
+    }
+
+    position = close + 1;
+    return true;
+  }
+
+  int parseRepeat()
+  {
+    int atom = parseAtom();
+
+    while (more())
+    {
+      char c = pattern[position];
+      int min, max;
+
+      if (c == '*')
+        min = 0, max = -1;
+      else if (c == '+')
+        min = 1, max = -1;
+      else if (c == '?')
+        min = 0, max = 1;
+      else if (c == '{')
+      {
+        position++;
+
+        if (!parseBound(min, max) or min > REGEX_MAX_REPEAT or max > REGEX_MAX_REPEAT or (max >= 0 and max < min))
+        {
+          error = "invalid repetition bound";
+          return -1;
+        }
+
+        atom = addNode(NODE_REPEAT, ByteSet(), {atom}, min, max);
+        continue;
+      }
+      else
+        break;
+
+      position++;
+      atom = addNode(NODE_REPEAT, ByteSet(), {atom}, min, max);
+    }
+
+    return atom;
+  }
+
+  int parseConcat()
+  {
+    std::vector<int> items;
+
+    while (more() and pattern[position] != '|' and pattern[position] != ')')
+      items.push_back(parseRepeat());
+
+    if (items.empty())
+      return addNode(NODE_EMPTY);
+
+    return items.size() == 1 ? items[0] : addNode(NODE_CONCAT, ByteSet(), items);
+  }
+
+  int parseAlternation()
+  {
+    std::vector<int> branches = {parseConcat()};
+
+    while (more() and pattern[position] == '|')
+    {
+      position++;
+      branches.push_back(parseConcat());
+    }
+
+    return branches.size() == 1 ? branches[0] : addNode(NODE_ALTERNATE, ByteSet(), branches);
+  }
+
+  int addState(StateType type, const ByteSet &bytes = ByteSet(), int out = -1, int out1 = -1)
+  {
+    states.push_back({type, bytes, out, out1});
+    return states.size() - 1;
+  }
+
+  void patch(const std::vector<std::pair<int, int>> &outs, int target)
+  {
+    for (auto [state, slot] : outs)
+      (slot == 0 ? states[state].out : states[state].out1) = target;
+  }
+
+  // Thompson's construction; a counted repetition compiles its operand once per copy.
+  Fragment compile(int index)
+  {
+    if (states.size() > REGEX_MAX_STATES)
+    {
+      error = "pattern too large";
+      return {addState(STATE_EPSILON), {}};
+    }
+
+    const Node node = nodes[index];
+
+    switch (node.kind)
+    {
+    case NODE_BYTES:
+    case NODE_EMPTY:
+    case NODE_BOL:
+    case NODE_EOL:
+    {
+      StateType type = node.kind == NODE_BYTES ? STATE_BYTES : node.kind == NODE_BOL ? STATE_BOL
+                                                           : node.kind == NODE_EOL   ? STATE_EOL
+                                                                                     : STATE_EPSILON;
+      int state = addState(type, node.bytes);
+      return {state, {{state, 0}}};
+    }
+
+    case NODE_CONCAT:
+    {
+      Fragment whole = compile(node.children[0]);
+
+      for (size_t i = 1; i < node.children.size(); i++)
+      {
+        Fragment next = compile(node.children[i]);
+        patch(whole.outs, next.start);
+        whole.outs = std::move(next.outs);
+      }
+
+      return whole;
+    }
+
+    case NODE_ALTERNATE:
+    {
+      Fragment whole = compile(node.children[0]);
+
+      for (size_t i = 1; i < node.children.size(); i++)
+      {
+        Fragment next = compile(node.children[i]);
+        whole.start = addState(STATE_SPLIT, ByteSet(), whole.start, next.start);
+        whole.outs.insert(whole.outs.end(), next.outs.begin(), next.outs.end());
+      }
+
+      return whole;
+    }
+
+    default:
+      break;
+    }
+
+    int entry = addState(STATE_EPSILON);
+    Fragment whole = {entry, {{entry, 0}}};
+
+    for (int i = 0; i < node.min; i++)
+    {
+      Fragment copy = compile(node.children[0]);
+      patch(whole.outs, copy.start);
+      whole.outs = std::move(copy.outs);
+    }
+
+    if (node.max < 0)
+    {
+      Fragment copy = compile(node.children[0]);
+      int loop = addState(STATE_SPLIT, ByteSet(), copy.start, -1);
+      patch(copy.outs, loop);
+      patch(whole.outs, loop);
+      whole.outs = {{loop, 1}};
+      return whole;
+    }
+
+    for (int i = node.min; i < node.max; i++)
+    {
+      Fragment copy = compile(node.children[0]);
+      int choice = addState(STATE_SPLIT, ByteSet(), copy.start, -1);
+      patch(whole.outs, choice);
+      whole.outs = std::move(copy.outs);
+      whole.outs.push_back({choice, 1});
+    }
+
+    return whole;
+  }
+
+  // Splits the bytes into classes no state tells apart; the newline always has a class of its own.
+  void buildClasses()
+  {
+    classes.fill(0);
+    uint16_t count = 1;
+
+    auto refine = [&](const ByteSet &set)
+    {
+      std::map<std::pair<uint16_t, bool>, uint16_t> renamed;
+
+      for (int c = 0; c < 256; c++)
+        classes[c] = renamed.emplace(std::make_pair(classes[c], set[c]), renamed.size()).first->second;
+
+      count = renamed.size();
+    };
+
+    ByteSet newline;
+    newline['\n'] = true;
+    refine(newline);
+
+    for (const State &state : states)
+      if (state.type == STATE_BYTES)
+        refine(state.bytes);
+
+    representatives.assign(count, 0);
+
+    for (int c = 255; c >= 0; c--)
+      representatives[classes[c]] = c;
+  }
+
+  // The longest run of single bytes in the top-level sequence: every match contains it. A pattern
+  // made of nothing else is that literal, and needs no automaton at all.
+  void extractLiteral(int root)
+  {
+    const Node &node = nodes[root];
+    std::vector<int> items = node.kind == NODE_CONCAT ? node.children : std::vector<int>{root};
+    std::string run;
+
+    exact = true;
+
+    for (int item : items)
+    {
+      const Node &part = nodes[item];
+
+      if (part.kind == NODE_BYTES and part.bytes.count() == 1)
+      {
+        for (int c = 0; c < 256; c++)
+          if (part.bytes[c])
+            run += static_cast<char>(c);
+      }
+      else if (part.kind != NODE_BOL and part.kind != NODE_EOL)
+        run.clear();
+
+      exact = exact and part.kind == NODE_BYTES and part.bytes.count() == 1;
+
+      if (run.size() > literal.size())
+        literal = run;
+    }
+
+    exact = exact and literal.size() == items.size();
+
+    if (!literal.empty())
+      prefilter = std::make_unique<Searcher>(literal);
+  }
+
+  static void nextGeneration(Dfa &work)
+  {
+    if (++work.generation == 0)
+    {
+      std::fill(work.marks.begin(), work.marks.end(), 0);
+      work.generation = 1;
+    }
+  }
+
+  // Adds the states reachable from `first` without reading a byte; `^` holds when `bol` is set and
+  // `$` when `eol` is, otherwise the assertion is kept in the set to be settled later.
+  static void addClosure(const std::vector<State> &states, int first, bool bol, bool eol, Dfa &work, std::vector<int> &set)
+  {
+    work.stack.assign(1, first);
+
+    while (!work.stack.empty())
+    {
+      int index = work.stack.back();
+      work.stack.pop_back();
+
+      if (index < 0 or work.marks[index] == work.generation)
+        continue;
+
+      work.marks[index] = work.generation;
+      const State &state = states[index];
+
+      switch (state.type)
+      {
+      case STATE_EPSILON:
+        work.stack.push_back(state.out);
+        break;
+
+      case STATE_SPLIT:
+        work.stack.push_back(state.out1);
+        work.stack.push_back(state.out);
+        break;
+
+      case STATE_BOL:
+        if (bol)
+          work.stack.push_back(state.out);
+        break;
+
+      case STATE_EOL:
+        if (eol)
+          work.stack.push_back(state.out);
+        else
+          set.push_back(index);
+        break;
+
+      default:
+        set.push_back(index);
+        break;
+      }
+    }
+  }
+
+  // Whether the set reaches the match state once the line ends here.
+  bool matchesAtEol(const std::vector<int> &set, bool bol, Dfa &work) const
+  {
+    std::vector<int> reached;
+    nextGeneration(work);
+
+    for (int index : set)
+    {
+      if (states[index].type == STATE_MATCH)
+        return true;
+
+      if (states[index].type == STATE_EOL)
+        addClosure(states, states[index].out, bol, true, work, reached);
+    }
+
+    return std::any_of(reached.begin(), reached.end(), [this](int index)
+                       { return states[index].type == STATE_MATCH; });
+  }
+
+  // The states after reading `byte` from `set`, plus a fresh start, since a match may begin anywhere.
+  void step(const std::vector<int> &set, unsigned char byte, Dfa &work, std::vector<int> &next) const
+  {
+    next.clear();
+    nextGeneration(work);
+
+    for (int index : set)
+      if (states[index].type == STATE_BYTES and states[index].bytes[byte])
+        addClosure(states, states[index].out, false, false, work, next);
+
+    addClosure(states, start, false, false, work, next);
+    std::sort(next.begin(), next.end());
+  }
+
+  int intern(Dfa &dfa, std::vector<int> set, bool bol) const
+  {
+    if (bol)
+      set.push_back(-1);
+
+    auto found = dfa.index.find(set);
+
+    if (found != dfa.index.end())
+      return found->second;
+
+    if (dfa.states.size() >= REGEX_DFA_MAX_STATES)
+      return -1;
+
+    int id = dfa.states.size();
+    dfa.index.emplace(set, id);
+
+    if (bol)
+      set.pop_back();
+
+    bool match = std::any_of(set.begin(), set.end(), [this](int index)
+                             { return states[index].type == STATE_MATCH; });
+
+    dfa.states.push_back({std::move(set), match, false});
+    dfa.states[id].matchAtEol = match or matchesAtEol(dfa.states[id].set, bol, dfa);
+    dfa.transitions.resize(dfa.states.size() * representatives.size(), -1);
+    dfa.accepting.push_back(match);
+
+    return id;
+  }
+
+  int startState(Dfa &dfa) const
+  {
+    if (dfa.initial >= 0)
+      return dfa.initial;
+
+    std::vector<int> set;
+    nextGeneration(dfa);
+    addClosure(states, start, true, false, dfa, set);
+    std::sort(set.begin(), set.end());
+    dfa.initial = intern(dfa, std::move(set), true);
+    return dfa.initial;
+  }
+
+  void reset(Dfa &dfa) const
+  {
+    dfa.states.clear();
+    dfa.transitions.clear();
+    dfa.accepting.clear();
+    dfa.initial = -1;
+    dfa.index.clear();
+  }
+
+  // The same search without a cache: every step recomputes the set of states.
+  const char *simulate(const char *begin, const char *end, Dfa &work) const
+  {
+    std::vector<int> current, next;
+    const char *lineStart = begin;
+
+    nextGeneration(work);
+    addClosure(states, start, true, false, work, current);
+
+    for (const char *p = begin;; p++)
+    {
+      // Past a final newline there is no line left to match.
+      if (p == end and lineStart == end)
+        return nullptr;
+
+      bool atEnd = p == end or *p == '\n';
+
+      for (int index : current)
+        if (states[index].type == STATE_MATCH)
+          return lineStart;
+
+      if (atEnd and matchesAtEol(current, p == lineStart, work))
+        return lineStart;
+
+      if (p == end)
+        return nullptr;
+
+      if (*p == '\n')
+      {
+        lineStart = p + 1;
+        current.clear();
+        nextGeneration(work);
+        addClosure(states, start, true, false, work, current);
+        continue;
+      }
+
+      step(current, *p, work, next);
+      current.swap(next);
+    }
+  }
+
+  // Returns the start of the first line of [begin, end) holding a match; `begin` starts a line.
+  const char *search(const char *begin, const char *end, Dfa &dfa) const
+  {
+    const size_t classCount = representatives.size();
+    const char *lineStart = begin;
+    int initial = startState(dfa);
+    int state = initial;
+
+    if (state < 0)
+    {
+      reset(dfa);
+      return simulate(begin, end, dfa);
+    }
+
+    const int32_t *table = dfa.transitions.data();
+    const uint8_t *accepting = dfa.accepting.data();
+
+    for (const char *p = begin; p < end; p++)
+    {
+      if (accepting[state])
+        return lineStart;
+
+      unsigned char c = *p;
+
+      if (c == '\n')
+      {
+        if (dfa.states[state].matchAtEol)
+          return lineStart;
+
+        lineStart = p + 1;
+        state = initial;
+        continue;
+      }
+
+      int32_t next = table[state * classCount + classes[c]];
+
+      if (next < 0)
+      {
+        step(dfa.states[state].set, c, dfa, dfa.set);
+        next = intern(dfa, dfa.set, false);
+
+        if (next < 0)
+        {
+          reset(dfa);
+          return simulate(lineStart, end, dfa);
+        }
+
+        dfa.transitions[state * classCount + classes[c]] = next;
+        table = dfa.transitions.data();
+        accepting = dfa.accepting.data();
+      }
+
+      state = next;
+    }
+
+    return lineStart < end and dfa.states[state].matchAtEol ? lineStart : nullptr;
+  }
+
+public:
+  explicit Regex(const std::string &p) : pattern(p), position(0), nesting(0), start(-1), exact(false), pool(std::make_unique<DfaPool>())
+  {
+    int root = parseAlternation();
+
+    if (error.empty() and position < pattern.size())
+      error = "unmatched parenthesis";
+
+    if (!error.empty())
+      return;
+
+    Fragment whole = compile(root);
+    patch(whole.outs, addState(STATE_MATCH));
+    start = whole.start;
+
+    if (!error.empty())
+      return;
+
+    buildClasses();
+    extractLiteral(root);
+    nodes.clear();
+  }
+
+  bool isValid() const
+  {
+    return error.empty();
+  }
+
+  const std::string &getError() const
+  {
+    return error;
+  }
+
+  const std::string &getLiteral() const
+  {
+    return literal;
+  }
+
+  // Returns a position inside the first matching line of [begin, end); `begin` starts a line.
+  const char *find(const char *begin, const char *end) const
+  {
+    if (exact)
+      return prefilter->find(begin, end);
+
+    std::unique_ptr<Dfa> dfa;
+
+    {
+      std::lock_guard<std::mutex> lock(pool->mutex);
+
+      if (!pool->idle.empty())
+      {
+        dfa = std::move(pool->idle.back());
+        pool->idle.pop_back();
+      }
+    }
+
+    if (!dfa)
+    {
+      dfa = std::make_unique<Dfa>();
+      dfa->marks.assign(states.size(), 0);
+    }
+
+    const char *hit = nullptr;
+
+    if (!prefilter)
+      hit = search(begin, end, *dfa);
+    else
+    {
+      for (const char *p = begin; p < end and hit == nullptr;)
+      {
+        const char *candidate = prefilter->find(p, end);
+
+        if (candidate == nullptr)
+          break;
+
+        const char *lineStart = static_cast<const char *>(memrchr(p, '\n', candidate - p));
+        lineStart = lineStart ? lineStart + 1 : p;
+
+        const char *lineEnd = static_cast<const char *>(memchr(candidate, '\n', end - candidate));
+        lineEnd = lineEnd ? lineEnd : end;
+
+        hit = search(lineStart, lineEnd, *dfa);
+        p = lineEnd + 1;
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    pool->idle.push_back(std::move(dfa));
+
+    return hit;
+  }
+};
+
+#endif
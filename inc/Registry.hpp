@@ -0,0 +1,137 @@
+#ifndef __REGISTRY_HPP__
+#define __REGISTRY_HPP__
+
+#include <array>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <functional>
+#include <cstdint>
+
+#include "Command.hpp"
+
+constexpr uint32_t hashName(std::string_view name, uint32_t seed)
+{
+  uint32_t hash = 2166136261u ^ seed;
+
+  for (char c : name)
+  {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 16777619u;
+  }
+
+  return hash ^ (hash >> 15);
+}
+
+// Collision-free hash over a fixed set of names. The seed is searched for while compiling,
+// so a lookup is one hash and one string comparison.
+template <size_t N>
+class PerfectHash
+{
+
+public:
+  static constexpr size_t SLOTS = [] {
+    size_t slots = 1;
+    while (slots < 2 * N)
+      slots <<= 1;
+    return slots;
+  }();
+
+private:
+  std::array<std::string_view, N> names;
+  std::array<std::string_view, SLOTS> table;
+  uint32_t seed;
+
+  constexpr bool isPerfect(uint32_t candidate) const
+  {
+    bool used[SLOTS] = {};
+
+    for (std::string_view name : names)
+    {
+      size_t slot = hashName(name, candidate) & (SLOTS - 1);
+
+      if (used[slot])
+        return false;
+
+      used[slot] = true;
+    }
+
+    return true;
+  }
+
+public:
+  constexpr PerfectHash(const std::array<std::string_view, N> &n) : names(n), table(), seed(0)
+  {
+    while (!isPerfect(seed))
+      seed++;
+
+    for (std::string_view name : names)
+      table[slot(name)] = name;
+  }
+
+  constexpr size_t slot(std::string_view name) const
+  {
+    return hashName(name, seed) & (SLOTS - 1);
+  }
+
+  constexpr bool contains(std::string_view name) const
+  {
+    return table[slot(name)] == name;
+  }
+};
+
+// Name-indexed table of the commands the shell can dispatch. Builtins land in the slots of the
+// perfect hash; anything registered later under another name goes to a regular hash map.
+template <size_t N, typename... Args>
+class CommandRegistry
+{
+
+public:
+  using Entry = Command<void, Args...>;
+
+private:
+  const PerfectHash<N> &hash;
+  std::array<std::unique_ptr<Entry>, PerfectHash<N>::SLOTS> builtins;
+  std::unordered_map<std::string, std::unique_ptr<Entry>> plugins;
+  std::vector<const Entry *> entries;
+
+public:
+  explicit CommandRegistry(const PerfectHash<N> &h) : hash(h) {}
+
+  Entry &add(const std::string &name, const std::string &description, const std::function<void(Args...)> &action)
+  {
+    std::unique_ptr<Entry> &entry = hash.contains(name) ? builtins[hash.slot(name)] : plugins[name];
+
+    if (!entry)
+    {
+      entry = std::make_unique<Entry>();
+      entries.push_back(entry.get());
+    }
+
+    entry->setName(name).setDescription(description).setAction(action);
+    return *entry;
+  }
+
+  Entry *find(std::string_view name)
+  {
+    const std::unique_ptr<Entry> &builtin = builtins[hash.slot(name)];
+
+    if (builtin and builtin->getName() == name)
+      return builtin.get();
+
+    if (plugins.empty())
+      return nullptr;
+
+    auto plugin = plugins.find(std::string(name));
+    return plugin == plugins.end() ? nullptr : plugin->second.get();
+  }
+
+  const std::vector<const Entry *> &list() const
+  {
+    return entries;
+  }
+};
+
+#endif
@@ -0,0 +1,197 @@
+#ifndef __REMOVE_HPP__
+#define __REMOVE_HPP__
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include "ThreadPool.hpp"
+
+#define REMOVAL_PROGRESS_INTERVAL std::chrono::milliseconds(500)
+
+struct RemovalProgress
+{
+  size_t files;
+  size_t directories;
+  double seconds;
+};
+
+// Removes a directory tree relative to open directory descriptors, so no path is ever rebuilt or
+// resolved again. Entry types come from d_type; each subdirectory is a task on the pool, opened only
+// once that task runs so queued ones hold no descriptor, and is unlinked by whichever worker removes
+// its last child.
+class TreeRemover
+{
+
+private:
+  struct Node
+  {
+    Node *parent;
+    int fd;
+    std::string name;
+    std::atomic<size_t> pending;
+  };
+
+  ThreadPool &pool;
+  std::atomic<size_t> files;
+  std::atomic<size_t> directories;
+  std::atomic<int> error;
+
+  void fail()
+  {
+    int expected = 0;
+    error.compare_exchange_strong(expected, errno);
+  }
+
+  void release(Node *node)
+  {
+    while (node->parent and --node->pending == 0)
+    {
+      Node *parent = node->parent;
+
+      if (node->fd >= 0)
+        close(node->fd);
+
+      if (unlinkat(parent->fd, node->name.c_str(), AT_REMOVEDIR) == 0)
+        directories++;
+      else
+        fail();
+
+      delete node;
+      node = parent;
+    }
+  }
+
+  void scan(Node *node)
+  {
+    if (node->fd < 0)
+      node->fd = openat(node->parent->fd, node->name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+
+    int fd = node->fd < 0 ? -1 : dup(node->fd);
+    DIR *dir = fd < 0 ? nullptr : fdopendir(fd);
+
+    if (dir == nullptr)
+    {
+      if (fd >= 0)
+        close(fd);
+      fail();
+      release(node);
+      return;
+    }
+
+    dirent *d;
+
+    while ((d = readdir(dir)) != nullptr)
+    {
+      if (!strcmp(d->d_name, ".") or !strcmp(d->d_name, ".."))
+        continue;
+
+      unsigned char type = d->d_type;
+
+      if (type == DT_UNKNOWN)
+      {
+        struct stat st;
+
+        if (fstatat(node->fd, d->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+        {
+          fail();
+          continue;
+        }
+
+        type = S_ISDIR(st.st_mode) ? DT_DIR : DT_REG;
+      }
+
+      if (type == DT_DIR)
+      {
+        Node *child = new Node{node, -1, d->d_name, {1}};
+        node->pending++;
+        pool.submit([this, child]
+                    { scan(child); });
+      }
+      else if (unlinkat(node->fd, d->d_name, 0) == 0)
+        files++;
+      else
+        fail();
+    }
+
+    closedir(dir);
+    release(node);
+  }
+
+public:
+  explicit TreeRemover(ThreadPool &p) : pool(p), files(0), directories(0), error(0) {}
+
+  // Returns 0 or the first errno met; `onProgress` is called periodically while the removal runs
+  // and once more at the end.
+  int remove(const std::string &path, const std::function<void(const RemovalProgress &)> &onProgress)
+  {
+    auto start = std::chrono::steady_clock::now();
+    std::string parentPath = ".", name = path;
+    size_t slash = path.find_last_of('/', path.find_last_not_of('/'));
+
+    if (slash != std::string::npos)
+    {
+      parentPath = slash == 0 ? "/" : path.substr(0, slash);
+      name = path.substr(slash + 1);
+    }
+
+    while (name.size() > 1 and name.back() == '/')
+      name.pop_back();
+
+    Node root{nullptr, open(parentPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC), "", {1}};
+
+    if (root.fd < 0)
+      return errno;
+
+    int fd = openat(root.fd, name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+
+    if (fd < 0)
+    {
+      int status = errno;
+      close(root.fd);
+      return status;
+    }
+
+    // Every directory whose subtree is still being removed keeps its descriptor, so a wide tree may
+    // need more than the soft limit; it is raised for the removal only, and commands run later do
+    // not inherit it.
+    struct rlimit limit, raised;
+    bool lifted = getrlimit(RLIMIT_NOFILE, &limit) == 0 and limit.rlim_cur < limit.rlim_max;
+
+    if (lifted)
+    {
+      raised = {limit.rlim_max, limit.rlim_max};
+      lifted = setrlimit(RLIMIT_NOFILE, &raised) == 0;
+    }
+
+    Node *top = new Node{&root, fd, name, {1}};
+    pool.submit([this, top]
+                { scan(top); });
+
+    auto report = [&]
+    {
+      std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+      onProgress({files.load(), directories.load(), elapsed.count()});
+    };
+
+    while (!pool.wait(REMOVAL_PROGRESS_INTERVAL))
+      report();
+
+    report();
+    close(root.fd);
+
+    if (lifted)
+      setrlimit(RLIMIT_NOFILE, &limit);
+
+    return error.load();
+  }
+};
+
+#endif
@@ -0,0 +1,272 @@
+#ifndef __RING_BUFFER_HPP__
+#define __RING_BUFFER_HPP__
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <streambuf>
+#include <thread>
+#include <algorithm>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#define RING_CHUNK_SIZE (64 * 1024)
+#define RING_CAPACITY 16
+#define RING_SPIN_LIMIT 64
+
+struct RingChunk
+{
+  size_t size;
+  char data[RING_CHUNK_SIZE];
+};
+
+// Where one side of a ring waits for the other. A waiter yields for a while, since the other side
+// is usually about to move, and then sleeps on a futex until notify() is called; a side that is
+// idle, like a stage behind `tail -f` on a quiet file, costs nothing until data arrives.
+class RingSignal
+{
+
+private:
+  std::atomic<uint32_t> sequence;
+  std::atomic<uint32_t> sleepers;
+
+  long futex(int operation, uint32_t value)
+  {
+    return syscall(SYS_futex, reinterpret_cast<uint32_t *>(&sequence), operation, value, nullptr, nullptr, 0);
+  }
+
+public:
+  RingSignal() : sequence(0), sleepers(0) {}
+
+  // Returns once `ready()` holds.
+  template <typename Ready>
+  void wait(Ready ready)
+  {
+    for (unsigned attempts = 0; !ready(); attempts++)
+    {
+      if (attempts < RING_SPIN_LIMIT)
+      {
+        std::this_thread::yield();
+        continue;
+      }
+
+      // The sleeper is counted before the sequence is read, and notify() bumps the sequence before
+      // it looks for sleepers: either it sees this one, or the futex sees the new sequence.
+      sleepers.fetch_add(1);
+      uint32_t seen = sequence.load();
+
+      if (!ready())
+        futex(FUTEX_WAIT_PRIVATE, seen);
+
+      sleepers.fetch_sub(1);
+    }
+  }
+
+  void notify()
+  {
+    sequence.fetch_add(1);
+
+    if (sleepers.load() > 0)
+      futex(FUTEX_WAKE_PRIVATE, INT_MAX);
+  }
+};
+
+// Bounded single-producer/single-consumer queue of fixed-size chunks. The producer waits while
+// all chunks are in flight, which is what keeps a fast stage from running ahead of a slow one.
+class RingBuffer
+{
+
+private:
+  std::unique_ptr<RingChunk[]> chunks;
+  alignas(64) std::atomic<size_t> head;
+  alignas(64) std::atomic<size_t> tail;
+  std::atomic<bool> closed;
+  std::atomic<bool> cancelled;
+  // Raised by the producer for the consumer, and by the consumer for the producer.
+  RingSignal filled;
+  RingSignal drained;
+
+public:
+  RingBuffer() : chunks(new RingChunk[RING_CAPACITY]), head(0), tail(0), closed(false), cancelled(false) {}
+
+  RingChunk *acquire()
+  {
+    const size_t position = tail.load(std::memory_order_relaxed);
+
+    drained.wait([&]
+                 { return position - head.load(std::memory_order_acquire) < RING_CAPACITY or
+                          cancelled.load(std::memory_order_acquire); });
+
+    if (cancelled.load(std::memory_order_acquire))
+      return nullptr;
+
+    return &chunks[position % RING_CAPACITY];
+  }
+
+  void commit()
+  {
+    tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    filled.notify();
+  }
+
+  RingChunk *front()
+  {
+    const size_t position = head.load(std::memory_order_relaxed);
+
+    filled.wait([&]
+                { return position != tail.load(std::memory_order_acquire) or closed.load(std::memory_order_acquire); });
+
+    if (position == tail.load(std::memory_order_acquire))
+      return nullptr;
+
+    return &chunks[position % RING_CAPACITY];
+  }
+
+  void release()
+  {
+    head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    drained.notify();
+  }
+
+  // Producer side: no more chunks will be committed.
+  void close()
+  {
+    closed.store(true, std::memory_order_release);
+    filled.notify();
+  }
+
+  // Consumer side: the remaining data will not be read, so the producer must stop waiting.
+  void cancel()
+  {
+    cancelled.store(true, std::memory_order_release);
+    drained.notify();
+  }
+};
+
+class RingWriter : public std::streambuf
+{
+
+private:
+  RingBuffer &ring;
+  RingChunk *chunk;
+
+  bool next()
+  {
+    if (chunk)
+    {
+      chunk->size = pptr() - pbase();
+      ring.commit();
+    }
+
+    chunk = ring.acquire();
+
+    if (chunk == nullptr)
+    {
+      setp(nullptr, nullptr);
+      return false;
+    }
+
+    setp(chunk->data, chunk->data + RING_CHUNK_SIZE);
+    return true;
+  }
+
+protected:
+  int_type overflow(int_type c) override
+  {
+    if (!next())
+      return traits_type::eof();
+
+    if (!traits_type::eq_int_type(c, traits_type::eof()))
+      sputc(traits_type::to_char_type(c));
+
+    return traits_type::not_eof(c);
+  }
+
+  std::streamsize xsputn(const char *data, std::streamsize size) override
+  {
+    std::streamsize written = 0;
+
+    while (written < size)
+    {
+      if (pptr() == epptr() and !next())
+        break;
+
+      std::streamsize n = std::min<std::streamsize>(size - written, epptr() - pptr());
+      memcpy(pptr(), data + written, n);
+      pbump(static_cast<int>(n));
+      written += n;
+    }
+
+    return written;
+  }
+
+  // A flush hands the partial chunk over at once, so a slow producer's output is not held back
+  // until a whole chunk fills; the next write takes a fresh one.
+  int sync() override
+  {
+    if (chunk and pptr() != pbase())
+    {
+      chunk->size = pptr() - pbase();
+      ring.commit();
+      chunk = nullptr;
+      setp(nullptr, nullptr);
+    }
+
+    return 0;
+  }
+
+public:
+  explicit RingWriter(RingBuffer &r) : ring(r), chunk(nullptr) {}
+
+  void close()
+  {
+    if (chunk and pptr() != pbase())
+    {
+      chunk->size = pptr() - pbase();
+      ring.commit();
+    }
+
+    chunk = nullptr;
+    setp(nullptr, nullptr);
+    ring.close();
+  }
+};
+
+class RingReader : public std::streambuf
+{
+
+private:
+  RingBuffer &ring;
+  RingChunk *chunk;
+
+protected:
+  int_type underflow() override
+  {
+    do
+    {
+      if (chunk)
+        ring.release();
+
+      chunk = ring.front();
+
+      if (chunk == nullptr)
+        return traits_type::eof();
+    } while (chunk->size == 0);
+
+    setg(chunk->data, chunk->data, chunk->data + chunk->size);
+    return traits_type::to_int_type(*gptr());
+  }
+
+public:
+  explicit RingReader(RingBuffer &r) : ring(r), chunk(nullptr) {}
+
+  void close()
+  {
+    ring.cancel();
+  }
+};
+
+#endif
@@ -0,0 +1,192 @@
+#ifndef __SEARCH_HPP__
+#define __SEARCH_HPP__
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstring>
+#include <cstddef>
+#include <sys/types.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SEARCH_X86
+#endif
+
+#define SEARCH_BLOCK_SIZE (1 << 20)
+
+inline const char *scalarFind(const char *begin, const char *end, const char *needle, size_t size)
+{
+  const char first = needle[0];
+
+  while (static_cast<size_t>(end - begin) >= size)
+  {
+    begin = static_cast<const char *>(memchr(begin, first, end - begin - size + 1));
+
+    if (begin == nullptr)
+      return nullptr;
+
+    if (memcmp(begin + 1, needle + 1, size - 1) == 0)
+      return begin;
+
+    begin++;
+  }
+
+  return nullptr;
+}
+
+#ifdef SEARCH_X86
+
+// Compares the first and the last byte of the needle against 16 candidate positions at once;
+// only the positions where both agree are verified with memcmp.
+inline const char *sse2Find(const char *begin, const char *end, const char *needle, size_t size)
+{
+  const __m128i first = _mm_set1_epi8(needle[0]);
+  const __m128i last = _mm_set1_epi8(needle[size - 1]);
+  const char *p = begin;
+
+  while (static_cast<size_t>(end - p) >= size + 15)
+  {
+    const __m128i blockFirst = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    const __m128i blockLast = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + size - 1));
+    unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, blockFirst), _mm_cmpeq_epi8(last, blockLast)));
+
+    while (mask)
+    {
+      const unsigned bit = __builtin_ctz(mask);
+
+      if (memcmp(p + bit + 1, needle + 1, size - 2) == 0)
+        return p + bit;
+
+      mask &= mask - 1;
+    }
+
+    p += 16;
+  }
+
+  return scalarFind(p, end, needle, size);
+}
+
+__attribute__((target("avx2"))) inline const char *avx2Find(const char *begin, const char *end, const char *needle, size_t size)
+{
+  const __m256i first = _mm256_set1_epi8(needle[0]);
+  const __m256i last = _mm256_set1_epi8(needle[size - 1]);
+  const char *p = begin;
+
+  while (static_cast<size_t>(end - p) >= size + 31)
+  {
+    const __m256i blockFirst = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+    const __m256i blockLast = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + size - 1));
+    unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(first, blockFirst), _mm256_cmpeq_epi8(last, blockLast)));
+
+    while (mask)
+    {
+      const unsigned bit = __builtin_ctz(mask);
+
+      if (memcmp(p + bit + 1, needle + 1, size - 2) == 0)
+        return p + bit;
+
+      mask &= mask - 1;
+    }
+
+    p += 32;
+  }
+
+  return sse2Find(p, end, needle, size);
+}
+
+#endif
+
+class Searcher
+{
+
+private:
+  std::string needle;
+  const char *(*kernel)(const char *, const char *, const char *, size_t);
+
+public:
+  explicit Searcher(const std::string &pattern) : needle(pattern), kernel(scalarFind)
+  {
+#ifdef SEARCH_X86
+    kernel = __builtin_cpu_supports("avx2") ? avx2Find : sse2Find;
+#endif
+  }
+
+  const std::string &getPattern() const
+  {
+    return needle;
+  }
+
+  const char *find(const char *begin, const char *end) const
+  {
+    if (needle.empty())
+      return begin < end ? begin : nullptr;
+
+    if (needle.size() == 1)
+      return static_cast<const char *>(memchr(begin, needle[0], end - begin));
+
+    if (static_cast<size_t>(end - begin) < needle.size())
+      return nullptr;
+
+    return kernel(begin, end, needle.data(), needle.size());
+  }
+};
+
+// Reads the source in fixed-size blocks and reports every line holding a match, without ever
+// materializing the lines. Only a line longer than the block makes the buffer grow.
+template <typename Matcher, typename Reader, typename Callback>
+bool scanLines(const Matcher &matcher, Reader read, Callback onLine, size_t blockSize = SEARCH_BLOCK_SIZE)
+{
+  std::vector<char> buffer(blockSize);
+  size_t carry = 0;
+  bool eof = false;
+
+  while (!eof)
+  {
+    ssize_t nread = read(buffer.data() + carry, buffer.size() - carry);
+
+    if (nread < 0)
+      return false;
+
+    eof = nread == 0;
+
+    const char *begin = buffer.data();
+    const char *end = begin + carry + nread;
+    const char *limit = end;
+
+    if (!eof)
+    {
+      const char *lastNewline = static_cast<const char *>(memrchr(begin, '\n', end - begin));
+      limit = lastNewline ? lastNewline + 1 : begin;
+    }
+
+    const char *p = begin;
+
+    while (p < limit)
+    {
+      const char *hit = matcher.find(p, limit);
+
+      if (hit == nullptr)
+        break;
+
+      const char *lineStart = static_cast<const char *>(memrchr(p, '\n', hit - p));
+      lineStart = lineStart ? lineStart + 1 : p;
+
+      const char *lineEnd = static_cast<const char *>(memchr(hit, '\n', limit - hit));
+      lineEnd = lineEnd ? lineEnd : limit;
+
+      onLine(std::string_view(lineStart, lineEnd - lineStart));
+      p = lineEnd + 1;
+    }
+
+    carry = end - limit;
+    memmove(buffer.data(), limit, carry);
+
+    if (carry == buffer.size())
+      buffer.resize(buffer.size() * 2);
+  }
+
+  return true;
+}
+
+#endif
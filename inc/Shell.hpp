@@ -4,26 +4,52 @@
 #include <iostream>
 #include <string>
 #include <vector>
-#include <stack>
 #include <limits>
 #include <unistd.h>
 #include <dirent.h>
 #include <sstream>
-#include <regex>
 #include <iomanip>
 #include <map>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <poll.h>
+#include <pwd.h>
 #include <memory>
 #include <fstream>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <cstring>
 
 #include "Command.hpp"
 #include "Utils.hpp"
 #include "IO.hpp"
-
-#define INPUT_REDIRECTION_SYMBOL '<'
-#define OUTPUT_REDIRECTION_SYMBOL '>'
+#include "Matcher.hpp"
+#include "Transfer.hpp"
+#include "Lexer.hpp"
+#include "Registry.hpp"
+#include "Process.hpp"
+#include "RingBuffer.hpp"
+#include "ThreadPool.hpp"
+#include "Remove.hpp"
+#include "Copy.hpp"
+#include "Batch.hpp"
+#include "MakeDirectory.hpp"
+#include "Listing.hpp"
+#include "Jobs.hpp"
+#include "Walk.hpp"
+#include "Timing.hpp"
+#include "History.hpp"
+#include "EntryCache.hpp"
+#include "Tail.hpp"
+#include "Count.hpp"
+#include "Completion.hpp"
+#include "LineEditor.hpp"
+
+// What other shells report for a command that cannot be found, or found but not run.
+#define EXIT_NOT_FOUND 127
+#define EXIT_NOT_EXECUTABLE 126
 
 enum ShellStatus
 {
@@ -35,114 +61,261 @@ enum ShellStatus
   FILE_NOT_FOUND,
   SAME_SOURCE_N_TARGET,
   MEMORY_ALLOCATION_FAILURE,
+  JOB_NOT_FOUND,
+  INVALID_PATTERN,
+  IS_A_DIRECTORY,
   QUIT_COMMAND
 };
 
+inline constexpr std::array<std::string_view, 26> BUILTIN_NAMES = {
+    "exit", "quit", "help", "echo", "pwd", "hostname", "username", "touch",
+    "mkdir", "rmfile", "ls", "rmdir", "mv", "cp", "cat", "cd", "grep",
+    "jobs", "fg", "bg", "wait", "time", "history", "dircache", "tail", "wc"};
+
+inline constexpr PerfectHash<BUILTIN_NAMES.size()> BUILTIN_HASH(BUILTIN_NAMES);
+static_assert(BUILTIN_HASH.contains("grep") and !BUILTIN_HASH.contains("grp"));
+
+// Builtins that change the shell itself: its directory, its jobs, its history, whether it goes on
+// running. In a pipeline they run in a forked stage, as every stage once did, and leave it alone.
+inline constexpr std::array<std::string_view, 8> STATEFUL_BUILTINS = {
+    "cd", "exit", "quit", "jobs", "fg", "bg", "wait", "history"};
+
+using Builtin = std::function<void(TokenSpan, bool)>;
+
 class Shell
 {
+  // bench/Bench.cpp times the parsing helpers directly.
+  friend class Benchmarks;
 
 private:
   bool isRunning = false;
-  IO io;
-
-  std::vector<pid_t> childProcesses;
+  // Scripts run without the prompt and the blank lines that frame it.
+  bool interactive = true;
+
+  // Each pipeline stage thread gets its own streams; the main thread's instance is the shell's.
+  static inline thread_local IO io;
+  static inline thread_local DirectoryLister lister;
+  Lexer lexer;
+  CommandRegistry<BUILTIN_NAMES.size(), TokenSpan, bool> registry{BUILTIN_HASH};
+  PathIndex pathIndex;
+  std::unique_ptr<ThreadPool> pool;
+  pid_t poolOwner = 0;
+
+  JobTable jobs;
+  History history;
+  EntryCache entryCache;
+  Completer completer{std::vector<std::string>(BUILTIN_NAMES.begin(), BUILTIN_NAMES.end()), pathIndex, entryCache};
+  LineEditor editor{STDIN_FILENO, STDOUT_FILENO, history, completer};
+  // Cleared in forked children: only the shell itself keeps a job table and hands out the terminal.
+  bool jobControl = true;
+  pid_t shellGroup = 0;
+  // While `time` runs a command, the largest peak RSS of the children reaped for it, in KiB; -1
+  // otherwise. Per thread, so timed stages of one pipeline measure only their own children.
+  static inline thread_local long childPeak = -1;
+  // How the last command line ended: a builtin's ShellStatus or a program's exit status. Each
+  // pipeline stage thread keeps its own.
+  static inline thread_local int lastStatus = SUCCESS;
 
   Command<std::string, const std::string &> $echo;
   Command<int> $exit;
   Command<std::string> $pwd;
   Command<std::string> $hostname;
   Command<std::string> $username;
-  Command<int, const std::string &> $touch;
-  Command<int, const std::string &> $mkdir;
-  Command<int, const std::string &> $rmfile;
+  Command<int, const std::vector<std::string> &, std::vector<int> &> $touch;
+  Command<int, const std::vector<std::string> &, std::vector<int> &> $mkdir;
+  Command<int, const std::vector<std::string> &, std::vector<int> &> $rmfile;
   Command<int, const std::string &> $rmdir;
-  Command<std::vector<dirent *>, const std::string &, const std::string &> $ls;
+  Command<int, const std::string &, const std::string &> $ls;
   Command<int, const std::string &, const std::string &> $mv;
-  Command<std::unique_ptr<std::string>, const std::string &, const bool &, int &> $cat;
+  Command<int, const std::string &, const std::string &, const bool &> $cp;
+  Command<int, const std::string &> $cat;
   Command<int, const std::string &> $cd;
-  Command<std::unique_ptr<std::vector<std::string>>, const std::string &, const bool &, const std::string &, int &> $grep;
+  Command<size_t, const std::string &, const bool &, const Matcher &, int &> $grep;
   Command<int, const pid_t &> $kill;
+  Command<int> $jobs;
+  Command<int, const std::string &> $fg;
+  Command<int, const std::string &> $bg;
+  Command<int, const std::string &> $wait;
+  Command<int, TokenSpan, bool> $time;
+  Command<int, const std::string &, const std::string &> $history;
+  Command<int> $dircache;
+  Command<int, const std::string &, const size_t &, const bool &> $tail;
+  Command<int, const std::vector<std::string> &, const std::string &, std::vector<Counts> &, std::vector<int> &> $wc;
+
+  std::string prompt;
+  int hostnameFd = -1;
+
+  // The user cannot change under a running shell, and the kernel flags an open hostname file
+  // to poll() whenever the hostname changes, so the prompt is only rebuilt then.
+  inline const std::string &currentPrompt()
+  {
+    struct pollfd watch = {hostnameFd, POLLPRI, 0};
+
+    if (prompt.empty() or (hostnameFd >= 0 and poll(&watch, 1, 0) > 0))
+      prompt = this->$hostname.execute() + '@' + this->$username.execute() + ":~$ ";
 
-  inline void printPrompt() { std::cout << this->$hostname.execute() << '@' << this->$username.execute() << ":~$ "; }
+    return prompt;
+  }
 
-  inline void inputRedirection(std::string &args)
+  inline void printPrompt()
   {
-    std::string inputStream = STDIN_STREAM;
+    std::cout << currentPrompt();
+  }
 
-    std::regex pattern("<\\s*(\"([^\"]*)\"|([^\\s]+))");
+  inline void inputRedirection(const std::string &inputStream)
+  {
+    if (io.setInputStream(inputStream) == INPUT_STREAM_FAIL)
+      std::cerr << "Input file not found.\n\n";
+  }
 
-    std::smatch match;
-    if (std::regex_search(args, match, pattern))
-    {
-      if (!match[2].str().empty())
-        inputStream = match[2].str();
-      else
-        inputStream = match[3].str();
-      args = std::regex_replace(args, pattern, "");
-    }
-    else
-      std::cerr << "Invalid parameter for INPUT_REDIRECTION_SYMBOL." << std::endl;
+  inline void outputRedirection(const std::string &outputStream)
+  {
+    if (io.setOutputStream(outputStream) == OUTPUT_STREAM_FAIL)
+      std::cerr << "Output file not found.\n\n";
+  }
 
-    if (inputStream != STDIN_STREAM)
-    {
-      if (io.setInputStream(inputStream) == INPUT_STREAM_FAIL)
-      {
-        std::cerr << "Input file not found.\n\n";
-        return;
-      }
-    }
-    else
-      io.setInputStream(STDIN_STREAM);
+  // A builtin that fails makes its failure the status of the line; success leaves the status alone,
+  // so one failed operand out of several still counts.
+  int recordStatus(int status)
+  {
+    if (status != SUCCESS)
+      lastStatus = status;
+
+    return status;
   }
 
-  inline void outputRedirection(std::string &args)
+  // The status a shell reports for a waited-for child: its exit code, or 128 plus the signal that
+  // ended or stopped it.
+  static int exitStatus(int status)
   {
-    std::string outputStream = STDOUT_STREAM;
-    std::regex pattern(">\\s*(\"([^\"]*)\"|([^\\s]+))");
+    if (WIFEXITED(status))
+      return WEXITSTATUS(status);
 
-    std::smatch match;
-    if (std::regex_search(args, match, pattern))
-    {
-      if (!match[2].str().empty())
-        outputStream = match[2].str();
-      else
-        outputStream = match[3].str();
+    return 128 + (WIFSTOPPED(status) ? WSTOPSIG(status) : WTERMSIG(status));
+  }
 
-      args = std::regex_replace(args, pattern, "");
-    }
-    else
-      std::cerr << "Invalid parameter for OUTPUT_REDIRECTION_SYMBOL." << std::endl;
+  // waitpid that also keeps the peak RSS of a child that ended, for `time` to report.
+  pid_t reap(pid_t pid, int *status, int options)
+  {
+    struct rusage usage;
+    int ended = 0;
+    pid_t result = wait4(pid, &ended, options, &usage);
 
-    if (io.setOutputStream(outputStream) == OUTPUT_STREAM_FAIL)
+    if (result == pid and childPeak >= 0 and !WIFSTOPPED(ended))
+      childPeak = std::max(childPeak, usage.ru_maxrss);
+
+    if (status)
+      *status = ended;
+
+    return result;
+  }
+
+  // The worker threads do not survive a fork, so a forked child builds its own pool; the parent's
+  // is deliberately leaked there, since its threads cannot be joined.
+  ThreadPool &workers()
+  {
+    if (pool and poolOwner != getpid())
+      pool.release();
+
+    if (!pool)
     {
-      std::cerr << "Output file not found.\n\n";
-      return;
+      pool = std::make_unique<ThreadPool>();
+      poolOwner = getpid();
     }
+
+    return *pool;
+  }
+
+  // Ends a builtin: its buffered output goes out before the blank line that precedes the next prompt.
+  inline void finish()
+  {
+    io.flush();
+
+    if (interactive)
+      puts("");
   }
 
-  std::vector<std::string> getItemsName(const std::string &text)
+  std::vector<std::string> getItemsName(std::string_view text)
   {
-    std::regex argPattern("\"([^\"]+)\"|([^\\s]+)");
-    std::vector<std::string> args;
+    Tokens tokens;
+    std::vector<std::string> items;
+
+    Lexer::tokenize(text, tokens);
+
+    for (const Token &token : tokens)
+      if (token.isWord())
+        items.emplace_back(token.text);
+
+    return items;
+  }
 
-    std::sregex_iterator it(text.begin(), text.end(), argPattern);
-    std::sregex_iterator end;
+  // Applies the `<` and `>` redirections the builtin accepts and calls `callback` for each of its
+  // operands: the remaining words or, when the input is redirected, the items read from the input,
+  // walked line by line in place.
+  template <typename Callback>
+  void forEachOperand(TokenSpan args, bool acceptInput, bool acceptOutput, Callback callback)
+  {
+    bool inputRedirected = false;
 
-    while (it != end)
+    for (size_t i = 0; i < args.size(); i++)
     {
-      std::smatch match = *it;
-      std::string value;
+      const Token &token = args[i];
 
-      if (match[1].matched)
-        value = match.str(1);
-      else
-        value = match.str(2);
+      if (token.type != INPUT_REDIRECTION and token.type != OUTPUT_REDIRECTION)
+        continue;
+
+      bool isInput = token.type == INPUT_REDIRECTION;
+
+      if (i + 1 == args.size() or !args[i + 1].isWord())
+      {
+        std::cerr << "Invalid parameter for " << (isInput ? "INPUT_REDIRECTION_SYMBOL." : "OUTPUT_REDIRECTION_SYMBOL.") << std::endl;
+        continue;
+      }
+
+      std::string target(args[++i].text);
+
+      if (isInput and acceptInput)
+      {
+        inputRedirection(target);
+        inputRedirected = !io.isStdinStream();
+      }
+      else if (!isInput and acceptOutput)
+        outputRedirection(target);
+    }
+
+    if (inputRedirected)
+    {
+      Tokens tokens;
+
+      for (std::string_view line : io.getInputLines())
+      {
+        Lexer::tokenize(line, tokens);
+
+        for (const Token &token : tokens)
+          if (token.isWord())
+            callback(token.text);
+      }
 
-      args.push_back(value);
-      ++it;
+      return;
+    }
+
+    for (size_t i = 0; i < args.size(); i++)
+    {
+      if (args[i].type == INPUT_REDIRECTION or args[i].type == OUTPUT_REDIRECTION)
+        i++;
+      else if (args[i].isWord())
+        callback(args[i].text);
     }
+  }
+
+  std::vector<std::string> getOperands(TokenSpan args, bool acceptInput = true, bool acceptOutput = true)
+  {
+    std::vector<std::string> operands;
+
+    forEachOperand(args, acceptInput, acceptOutput, [&operands](std::string_view operand)
+                   { operands.emplace_back(operand); });
 
-    return args;
+    return operands;
   }
 
   void exitSetup()
@@ -202,7 +375,15 @@ private:
         .setAction(
             []() -> std::string
             {
-              return std::string(getlogin());
+              const char *name = getlogin();
+
+              if (name == nullptr)
+              {
+                struct passwd *entry = getpwuid(geteuid());
+                name = entry ? entry->pw_name : "?";
+              }
+
+              return name;
             });
   }
 
@@ -211,16 +392,20 @@ private:
     $touch.setName("touch")
         .setDescription("Generates a blank file.")
         .setAction(
-            [](const std::string &filename) -> int
+            [this](const std::vector<std::string> &filenames, std::vector<int> &statuses) -> int
             {
-              mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
-              int fd = open(filename.c_str(), O_WRONLY | O_CREAT, mode);
+              std::vector<BatchResult> results;
+              MetadataBatch(workers(), BATCH_CREATE, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH).run(filenames, results);
 
-              if (fd < 0)
-                return OPEN_FILE_FAILURE;
+              statuses.resize(results.size());
 
-              if (close(fd) < 0)
-                return CLOSE_FILE_FAILURE;
+              for (size_t i = 0; i < results.size(); i++)
+              {
+                if (results[i].error == 0)
+                  statuses[i] = SUCCESS;
+                else
+                  statuses[i] = results[i].closing ? CLOSE_FILE_FAILURE : OPEN_FILE_FAILURE;
+              }
 
               return SUCCESS;
             });
@@ -231,32 +416,19 @@ private:
     $mkdir.setName("mkdir")
         .setDescription("Generate a new directory.")
         .setAction(
-            [](const std::string &path) -> int
+            [this](const std::vector<std::string> &paths, std::vector<int> &statuses) -> int
             {
-              std::string p;
-              int status;
-
-              if (not(path[0] == '/' or path[0] == '~' or (path[0] == '.' and path[1] == '/')))
-                p = '.';
+              std::vector<std::string> expanded;
+              expanded.reserve(paths.size());
 
-              std::string $path = path;
-              std::regex pattern("^~");
+              for (const std::string &path : paths)
+                expanded.push_back(expandHome(path));
 
-              if (std::regex_search($path, pattern))
-              {
-                const char *home = std::getenv("HOME");
-                if (home)
-                  $path = std::regex_replace($path, pattern, home);
-              }
+              DirectoryMaker(workers()).createAll(expanded, statuses);
 
-              for (auto &str : split($path, '/'))
-              {
-                p += "/" + str;
-                status = mkdir(p.c_str(), S_IRWXU | S_IRWXG | S_IRWXO);
-              }
+              for (int &status : statuses)
+                status = status == 0 ? SUCCESS : FAILURE;
 
-              if (status < 0)
-                return FAILURE;
               return SUCCESS;
             });
   }
@@ -264,89 +436,65 @@ private:
   void rmfileSetup()
   {
     $rmfile.setName("rmfile")
-        .setDescription("Generate a new directory.")
+        .setDescription("Removes a file.")
         .setAction(
-            [](const std::string &path) -> int
+            [this](const std::vector<std::string> &paths, std::vector<int> &statuses) -> int
             {
-              std::string newPath = path;
-
-              if (not(path[0] == '/' or path[0] == '~' or (path[0] == '.' and path[1] == '/')))
-                newPath = "./" + path;
+              std::vector<std::string> expanded;
+              std::vector<BatchResult> results;
+              expanded.reserve(paths.size());
 
-              std::regex pattern("^~");
-
-              if (std::regex_search(newPath, pattern))
+              for (const std::string &path : paths)
               {
-                const char *home = std::getenv("HOME");
-                if (home)
-                  newPath = std::regex_replace(newPath, pattern, home);
+                if (not(path[0] == '/' or path[0] == '~' or (path[0] == '.' and path[1] == '/')))
+                  expanded.push_back(expandHome("./" + path));
+                else
+                  expanded.push_back(expandHome(path));
               }
 
-              if (!unlink(newPath.c_str()))
-                return SUCCESS;
-              else
-                return FAILURE;
+              MetadataBatch(workers(), BATCH_UNLINK).run(expanded, results);
+
+              statuses.resize(results.size());
+
+              for (size_t i = 0; i < results.size(); i++)
+                statuses[i] = results[i].error == 0 ? SUCCESS : FAILURE;
+
+              return SUCCESS;
             });
   }
 
   void lsSetup()
   {
     $ls.setName("ls")
-        .setDescription("Generate a new directory.")
+        .setDescription("Lists the contents of a directory.")
         .setAction(
-            [this](const std::string &path, const std::string &mode) -> std::vector<dirent *>
+            [this](const std::string &path, const std::string &mode) -> int
             {
-              std::string $path = path;
-              std::regex pattern("^~");
-
-              if (std::regex_search($path, pattern))
-              {
-                const char *home = std::getenv("HOME");
-                if (home)
-                  $path = std::regex_replace($path, pattern, home);
-              }
-
-              DIR *dir = opendir($path.c_str());
-              dirent *d;
-
-              bool list = contains(mode, 'l');
-              bool all = contains(mode, 'a');
-
-              if (dir == nullptr)
-                return {};
-
-              std::vector<dirent *> dirs;
-
-              while ((d = readdir(dir)) != nullptr)
-              {
-
-                if (!all and d->d_name[0] == '.')
-                  continue;
-
-                dirs.push_back(d);
-              }
-
-              std::sort(dirs.begin(), dirs.end(), [](const dirent *a, const dirent *b)
-                        { return (std::string)a->d_name < b->d_name; });
-
-              if (!contains(mode, 'x'))
+              bool longFormat = contains(mode, 'l');
+              std::string directory = expandHome(path);
+              auto output = [longFormat](std::string_view text)
               {
-                for (dirent *dir : dirs)
-                {
-                  if (dir == nullptr)
-                    continue;
-
-                  if (list)
-                    this->io.setOutputLine(std::string(dir->d_name));
-                  else
-                    this->io.setOutput(std::string(dir->d_name) + "\t");
-                }
-
-                if (!list)
-                  this->io.setOutputLine("");
-              }
+                if (longFormat)
+                  io.setOutputLine(text);
+                else
+                  io.setOutput(text);
+              };
+              int error = 0;
+
+              // An unsorted listing streams the directory in constant memory; a sorted one comes from
+              // the cache.
+              if (contains(mode, 'U'))
+                error = lister.list(directory, contains(mode, 'a'), longFormat, true, workers(), output);
+              else if (auto entries = entryCache.get(directory, error))
+                error = lister.list(*entries, directory, contains(mode, 'a'), longFormat, workers(), output);
+
+              if (!longFormat)
+                io.setOutputLine("");
+
+              if (error == ENOENT or error == ENOTDIR)
+                return FILE_NOT_FOUND;
 
-              return dirs;
+              return error == 0 ? SUCCESS : FAILURE;
             });
   }
 
@@ -359,78 +507,51 @@ private:
       if (not(path[0] == '/' or path[0] == '~' or (path[0] == '.' and path[1] == '/')))
         path = "./" + path;
 
-      std::regex pattern("^~");
-
-      if (std::regex_search(path, pattern))
-      {
-        const char *home = std::getenv("HOME");
-        if (home)
-          path = std::regex_replace(path, pattern, home);
-      }
+      path = expandHome(path);
 
-      if ($ls.execute(path, "ax").size() > 2)
+      if (!entryCache.isEmpty(path))
       {
         std::cout << "This directory contains files and/or directories. When you continue, they will all be removed.\n";
         std::cout << "Do you wish to continue [y/n]?\n";
-        std::string res;
-        std::cin >> res;
+        std::string_view res;
 
-        if (res[0] == 'n')
+        if (!io.getStdinLines().next(res) or trim(std::string(res))[0] == 'n')
           return SUCCESS;
       }
 
-      std::vector<std::string> dirs;
-      std::stack<std::string> dirsToRemove;
-      dirs.push_back(path);
+      TreeRemover remover(workers());
+      RemovalProgress last = {0, 0, 0};
+      bool showProgress = isatty(STDERR_FILENO);
+      bool shownProgress = false;
 
-      while (!dirs.empty())
+      auto onProgress = [&](const RemovalProgress &progress)
       {
-        std::string current_dir = dirs.back();
-        dirs.pop_back();
-
-        auto items = $ls.execute(current_dir, "ax");
-
-        dirsToRemove.push(current_dir);
+        last = progress;
 
-        if (items.size() <= 2)
+        if (showProgress and progress.seconds >= 0.5)
         {
-          continue;
+          std::cerr << "\rRemoving: " << progress.files << " files, " << progress.directories << " directories" << std::flush;
+          shownProgress = true;
         }
+      };
 
-        for (auto &item : items)
-        {
-          if (!strcmp(item->d_name, ".") or !strcmp(item->d_name, ".."))
-            continue;
-
-          std::string p = current_dir + "/" + item->d_name;
-
-          struct stat st;
+      int error = remover.remove(path, onProgress);
 
-          if (lstat(p.c_str(), &st) < 0)
-            return READ_FAILURE;
+      if (shownProgress)
+        std::cerr << '\n';
 
-          if (S_ISDIR(st.st_mode))
-          {
-            dirs.push_back(p);
-          }
-          else
-          {
-            int status = $rmfile.execute(p);
+      size_t entries = last.files + last.directories;
 
-            if (status != SUCCESS)
-              return status;
-          }
-        }
-      }
+      if (error == 0 or entries > 0)
+        std::cout << "Removed " << last.files << " files and " << last.directories << " directories in "
+                  << std::fixed << std::setprecision(3) << last.seconds << " s ("
+                  << std::setprecision(0) << (last.seconds > 0 ? entries / last.seconds : 0) << " entries/s).\n"
+                  << std::defaultfloat;
 
-      while (!dirsToRemove.empty())
-      {
-        if (rmdir(dirsToRemove.top().c_str()) != 0)
-          return FAILURE;
-        dirsToRemove.pop();
-      }
+      if (error == ENOENT)
+        return FILE_NOT_FOUND;
 
-      return SUCCESS;
+      return error == 0 ? SUCCESS : FAILURE;
     };
 
     $rmdir.setName("rmdir")
@@ -438,72 +559,95 @@ private:
         .setAction(rmdirAction);
   }
 
+  // Where `source` lands when moved or copied to `target`: inside it, when it is a directory.
+  static std::string destinationPath(const std::string &source, const std::string &target)
+  {
+    struct stat target_sb;
+
+    if (stat(target.c_str(), &target_sb) == -1 or !S_ISDIR(target_sb.st_mode))
+      return target;
+
+    std::string name = source.substr(0, source.find_last_not_of('/') + 1);
+    name = name.substr(name.find_last_of('/') + 1);
+
+    return target.back() == '/' ? target + name : target + '/' + name;
+  }
+
   void mvSetup()
   {
     $mv.setName("mv")
         .setDescription("Move or rename a file or directory.")
         .setAction(
-            [](const std::string &_source, const std::string &_target) -> int
+            [this](const std::string &_source, const std::string &_target) -> int
             {
               struct stat source_sb;
 
-              std::string source = _source;
-              std::regex pattern("^~");
-
-              if (std::regex_search(source, pattern))
-              {
-                const char *home = std::getenv("HOME");
-                if (home)
-                  source = std::regex_replace(source, pattern, home);
-              }
-
-              std::string target = _target;
-
-              if (std::regex_search(target, pattern))
-              {
-                const char *home = std::getenv("HOME");
-                if (home)
-                  target = std::regex_replace(target, pattern, home);
-              }
+              std::string source = expandHome(_source);
+              std::string target = expandHome(_target);
 
-              if (stat(source.c_str(), &source_sb) == -1)
+              if (lstat(source.c_str(), &source_sb) == -1)
                 return FILE_NOT_FOUND;
 
               struct stat target_sb;
 
-              if (stat(target.c_str(), &target_sb) != -1 && target_sb.st_ino == source_sb.st_ino)
+              if (stat(target.c_str(), &target_sb) != -1 && target_sb.st_ino == source_sb.st_ino && target_sb.st_dev == source_sb.st_dev)
                 return SAME_SOURCE_N_TARGET;
 
-              if (stat(target.c_str(), &target_sb) != -1)
-              {
+              std::string destination = destinationPath(source, target);
 
-                if (S_ISDIR(target_sb.st_mode))
-                {
+              if (rename(source.c_str(), destination.c_str()) == 0)
+                return SUCCESS;
+
+              if (errno != EXDEV)
+                return FAILURE;
 
-                  const char *filename = strrchr(source.c_str(), '/');
+              // rename cannot cross filesystems: copy, keeping the times a rename would have kept, then
+              // remove the source.
+              CopyProgress progress;
 
-                  if (!filename)
-                    filename = source.c_str();
-                  else
-                    filename++;
+              if (TreeCopier(workers(), true).copy(source, destination, progress) != 0)
+                return FAILURE;
 
-                  char targetPath[source.size() + strlen(filename) + 2];
+              if (!S_ISDIR(source_sb.st_mode))
+                return unlink(source.c_str()) == 0 ? SUCCESS : FAILURE;
 
-                  sprintf(targetPath, "%s/%s", target.c_str(), filename);
+              return TreeRemover(workers()).remove(source, [](const RemovalProgress &) {}) == 0 ? SUCCESS : FAILURE;
+            });
+  }
 
-                  if (rename(source.c_str(), targetPath) == -1)
-                    return FAILURE;
-                }
-                else if (rename(source.c_str(), target.c_str()) == -1)
-                  return FAILURE;
-              }
-              else
-              {
-                if (rename(source.c_str(), target.c_str()) == -1)
-                  return FAILURE;
-              }
+  void cpSetup()
+  {
+    $cp.setName("cp")
+        .setDescription("Copies a file, or a directory with -r.")
+        .setAction(
+            [this](const std::string &_source, const std::string &_target, const bool &recursive) -> int
+            {
+              struct stat source_sb, target_sb;
 
-              return SUCCESS;
+              std::string source = expandHome(_source);
+              std::string target = expandHome(_target);
+
+              if (lstat(source.c_str(), &source_sb) == -1)
+                return FILE_NOT_FOUND;
+
+              if (S_ISDIR(source_sb.st_mode) and !recursive)
+                return IS_A_DIRECTORY;
+
+              std::string destination = destinationPath(source, target);
+
+              if (stat(destination.c_str(), &target_sb) != -1 && target_sb.st_ino == source_sb.st_ino && target_sb.st_dev == source_sb.st_dev)
+                return SAME_SOURCE_N_TARGET;
+
+              CopyProgress progress;
+              int error = TreeCopier(workers()).copy(source, destination, progress);
+
+              if (S_ISDIR(source_sb.st_mode) and progress.files + progress.directories > 0)
+                std::cout << "Copied " << progress.files << " files and " << progress.directories << " directories ("
+                          << std::fixed << std::setprecision(1) << progress.bytes / 1048576.0 << " MB) in "
+                          << std::setprecision(3) << progress.seconds << " s.\n"
+                          << std::defaultfloat;
+
+              return error == 0 ? SUCCESS : FAILURE;
             });
   }
 
@@ -512,64 +656,149 @@ private:
     $cat.setName("cat")
         .setDescription("Displays the contents of a file in the shell.")
         .setAction(
-            [this](const std::string &filepath_, const bool &print = true, int &status) -> std::unique_ptr<std::string>
+            [this](const std::string &filepath) -> int
             {
+              int fd = open(expandHome(filepath).c_str(), O_RDONLY);
+
+              if (fd < 0)
+                return OPEN_FILE_FAILURE;
+
+              struct stat sb;
+
+              if (fstat(fd, &sb) < 0)
+              {
+                close(fd);
+                return READ_FAILURE;
+              }
 
-              std::string filepath = filepath_;
-              std::regex pattern("^~");
+              posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
 
-              if (std::regex_search(filepath, pattern))
+              int outputFd = this->io.getOutputDescriptor();
+              bool transferred;
+
+              if (!S_ISREG(sb.st_mode) or sb.st_size == 0)
+                transferred = readAll(fd, [this](std::string_view block)
+                                      { this->io.setOutput(block); });
+              else if (outputFd >= 0)
+                transferred = transferFile(fd, outputFd, sb.st_size);
+              else
               {
-                const char *home = std::getenv("HOME");
-                if (home)
-                  filepath = std::regex_replace(filepath, pattern, home);
+                MappedFile mapping;
+                transferred = mapping.map(fd, sb.st_size);
+
+                if (transferred)
+                  this->io.setOutput(mapping.data());
               }
 
-              int fd = open(filepath.c_str(), O_RDONLY);
-              ssize_t nread, total = 0;
-              char *buffer;
+              close(fd);
+
+              return transferred ? SUCCESS : READ_FAILURE;
+            });
+  }
+
+  void tailSetup()
+  {
+    $tail.setName("tail")
+        .setDescription("Displays the last lines of a file, and with -f what is appended to it.")
+        .setAction(
+            [this](const std::string &filepath, const size_t &count, const bool &follow) -> int
+            {
+              std::string path = expandHome(filepath);
+              int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
 
               if (fd < 0)
+                return OPEN_FILE_FAILURE;
+
+              struct stat sb = {};
+
+              if (fstat(fd, &sb) < 0 or S_ISDIR(sb.st_mode))
               {
-                status = OPEN_FILE_FAILURE;
-                return nullptr;
+                close(fd);
+                return S_ISDIR(sb.st_mode) ? IS_A_DIRECTORY : READ_FAILURE;
               }
 
-              off_t fileSize = lseek(fd, 0, SEEK_END);
-              lseek(fd, 0, SEEK_SET);
+              auto output = [](std::string_view block)
+              { io.setOutput(block); };
+              off_t start;
 
-              buffer = (char *)malloc(fileSize);
+              if (!findLastLines(fd, sb.st_size, count, start) or !copyRange(fd, start, sb.st_size, output))
+              {
+                close(fd);
+                return READ_FAILURE;
+              }
 
-              if (buffer == nullptr)
+              if (!follow)
               {
-                status = MEMORY_ALLOCATION_FAILURE;
-                return nullptr;
+                close(fd);
+                return SUCCESS;
               }
 
-              // Lê o arquivo em um loop
-              while ((nread = read(fd, buffer + total, fileSize - total)) > 0)
-                total += nread;
+              // Each block goes out as soon as it is read; ^C ends the watch, not the shell.
+              this->io.flush();
+
+              InterruptWatch interrupt;
+              FileFollower follower(path, fd, start);
 
-              if (nread < 0)
+              int error = follower.follow(interrupt.descriptor(), [](std::string_view block)
+                                          {
+                                            io.setOutput(block);
+                                            io.flush(); });
+
+              return error == 0 ? SUCCESS : READ_FAILURE;
+            });
+  }
+
+  void wcSetup()
+  {
+    $wc.setName("wc")
+        .setDescription("Counts the lines, words and bytes of files.")
+        .setAction(
+            [this](const std::vector<std::string> &paths, const std::string &mode, std::vector<Counts> &counts,
+                   std::vector<int> &statuses) -> int
+            {
+              bool lines = contains(mode, 'l'), words = contains(mode, 'w');
+
+              // Without files, the input is what the previous stage of the pipeline writes, or the file
+              // redirected in.
+              if (paths.empty())
               {
-                status = READ_FAILURE;
-                return nullptr;
+                Counter counter(words);
+                bool readOk = counter.addAll([](char *buffer, size_t size)
+                                             { return io.read(buffer, size); });
+
+                counts.assign(1, counter.result());
+                statuses.assign(1, readOk ? SUCCESS : READ_FAILURE);
+                return statuses[0];
               }
 
-              if (buffer[fileSize - 1] == '\n')
-                buffer[fileSize - 1] = '\0';
+              counts.assign(paths.size(), {0, 0, 0});
+              statuses.assign(paths.size(), SUCCESS);
 
-              std::unique_ptr<std::string> content = std::make_unique<std::string>(buffer);
+              auto countOne = [&paths, &counts, &statuses, lines, words](size_t i)
+              {
+                int error = countFile(expandHome(paths[i]), lines, words, counts[i]);
 
-              if (print)
-                this->io.setOutputLine(content->c_str());
+                statuses[i] = error == 0        ? SUCCESS
+                              : error == EISDIR ? IS_A_DIRECTORY
+                              : error == EIO    ? READ_FAILURE
+                                                : OPEN_FILE_FAILURE;
+              };
 
-              free(buffer);
-              close(fd);
+              // Each file is streamed by a worker of its own.
+              if (paths.size() == 1)
+                countOne(0);
+              else
+              {
+                ThreadPool &pool = workers();
+
+                for (size_t i = 0; i < paths.size(); i++)
+                  pool.submit([&countOne, i]
+                              { countOne(i); });
 
-              status = SUCCESS;
+                pool.wait();
+              }
 
-              return content;
+              return SUCCESS;
             });
   }
 
@@ -580,53 +809,60 @@ private:
         .setAction(
             [](const std::string &path) -> int
             {
-              std::string $path = path;
-              std::regex pattern("^~");
-
-              if (std::regex_search($path, pattern))
-              {
-                const char *home = std::getenv("HOME");
-                if (home)
-                  $path = std::regex_replace($path, pattern, home);
-              }
-              return chdir($path.c_str());
+              return chdir(expandHome(path).c_str());
             });
   }
 
   void grepSetup()
   {
-    auto grepAction = [this](const std::string &source, const bool &sourceIsFile, const std::string &pattern, int &status) -> std::unique_ptr<std::vector<std::string>>
+    auto grepAction = [this](const std::string &source, const bool &sourceIsFile, const Matcher &searcher, int &status) -> size_t
     {
-      std::unique_ptr<std::string> content;
-
-      if (sourceIsFile)
-        content = $cat.execute(source, false, status);
-      else
-        content = std::make_unique<std::string>(source);
+      size_t matches = 0;
 
-      if (content)
+      auto printLine = [this, &matches, &searcher](std::string_view line)
       {
-        auto lines = split(*content, '\n');
+        if (searcher.isLabelled())
+        {
+          const std::string_view pieces[] = {"[", searcher.label(line), "] "};
 
-        std::unique_ptr<std::vector<std::string>> ans = std::make_unique<std::vector<std::string>>();
+          for (std::string_view piece : pieces)
+            this->io.setOutput(piece);
+        }
 
-        if (lines.size() == 1)
-          lines = split(*content, ' ');
+        this->io.setOutputLine(line);
+        matches++;
+      };
 
-        for (auto &str : lines)
-        {
-          if (str.find(pattern) != std::string::npos)
-          {
-            ans->push_back(str);
-            this->io.setOutputLine(str);
-          }
-        }
+      if (!sourceIsFile)
+      {
+        bool readOk = scanLines(
+            searcher, [this](char *buffer, size_t size) -> ssize_t
+            { return this->io.read(buffer, size); },
+            printLine);
 
-        status = SUCCESS;
-        return ans;
+        status = readOk ? SUCCESS : READ_FAILURE;
+        return matches;
       }
 
-      return nullptr;
+      int fd = open(expandHome(source).c_str(), O_RDONLY);
+
+      if (fd < 0)
+      {
+        status = OPEN_FILE_FAILURE;
+        return 0;
+      }
+
+      posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+      bool readOk = scanLines(
+          searcher, [fd](char *buffer, size_t size) -> ssize_t
+          { return read(fd, buffer, size); },
+          printLine);
+
+      close(fd);
+
+      status = readOk ? SUCCESS : READ_FAILURE;
+      return matches;
     };
 
     $grep.setName("grep")
@@ -645,46 +881,409 @@ private:
             });
   }
 
-  void echo(std::string &args)
+  Job *findJob(const std::string &target)
   {
-    std::string msg = "";
-    std::istringstream iss;
-
-    if (contains(args, INPUT_REDIRECTION_SYMBOL))
-      inputRedirection(args);
-
-    if (contains(args, OUTPUT_REDIRECTION_SYMBOL))
-      outputRedirection(args);
-
-    if (io.isStdinStream())
-    {
-      iss = std::istringstream(args);
-      io.setInputStream(iss);
-    }
+    if (target.empty())
+      return jobs.current();
 
-    msg = this->io.getAllInputLines();
+    char *end;
+    long number = strtol(target.c_str() + (target[0] == '%'), &end, 10);
 
-    io.setOutputLine(trim(msg));
+    if (*end != '\0')
+      return nullptr;
 
-    io.setOutputStream(STDOUT_STREAM);
-    io.setInputStream(STDIN_STREAM);
+    Job *job = jobs.find(number);
+    return job ? job : jobs.findByPid(number);
   }
 
-  void cat(std::string &args)
+  // Prints the jobs that stopped or ended since the last report and forgets the ended ones;
+  // `interrupting` moves off a prompt that is already on the screen first.
+  bool reportJobs(bool interrupting = false)
   {
-    std::vector<std::string> items = this->getItemsName(args);
-    std::string msg = "";
-
-    if (contains(args, OUTPUT_REDIRECTION_SYMBOL))
-      outputRedirection(args);
+    bool reported = false;
 
-    if (items.size() > 0)
+    for (auto job = jobs.list().begin(); job != jobs.list().end();)
     {
-      int status;
+      Job &entry = job->second;
+      int id = job->first;
+      job++;
 
-      this->$cat.execute(trim(items[0]), true, status);
+      if (!entry.changed)
+        continue;
 
-      switch (status)
+      entry.changed = false;
+
+      if (interrupting and !reported)
+        std::cout << "\n";
+
+      reported = true;
+      std::cout << "[" << id << "] ";
+
+      if (entry.state == JOB_STOPPED)
+        std::cout << "Process stopped! (PID: " << entry.pid << ")";
+      else if (entry.state == JOB_RUNNING)
+        std::cout << "Process resumed! (PID: " << entry.pid << ")";
+      else if (WIFSIGNALED(entry.status))
+        std::cout << "Process terminated by signal " << WTERMSIG(entry.status) << "! (PID: " << entry.pid << ")";
+      else
+        std::cout << "Process completed! (PID: " << entry.pid << ")";
+
+      std::cout << "  " << entry.command << "\n";
+
+      if (entry.state == JOB_DONE)
+        jobs.remove(id);
+    }
+
+    if (reported)
+      std::cout << "\n";
+
+    return reported;
+  }
+
+  void jobsSetup()
+  {
+    $jobs.setName("jobs")
+        .setDescription("Lists the background jobs.")
+        .setAction(
+            [this]() -> int
+            {
+              jobs.poll();
+
+              for (const auto &[id, job] : jobs.list())
+              {
+                const char *state = job.state == JOB_RUNNING ? "Running" : job.state == JOB_STOPPED ? "Stopped"
+                                                                                                     : "Done";
+                std::ostringstream line;
+                line << "[" << id << "] " << std::left << std::setw(8) << job.pid << std::setw(9) << state << job.command;
+                this->io.setOutputLine(line.str());
+              }
+
+              return SUCCESS;
+            });
+  }
+
+  void dircacheSetup()
+  {
+    $dircache.setName("dircache")
+        .setDescription("Shows how often the directory cache was hit.")
+        .setAction(
+            [this]() -> int
+            {
+              EntryCacheStats stats = entryCache.stats();
+
+              this->io.setOutputLine("Directories: " + std::to_string(stats.directories) + " (" +
+                                     std::to_string(stats.bytes / 1024) + " KiB of names)");
+              this->io.setOutputLine("Hits: " + std::to_string(stats.hits));
+              this->io.setOutputLine("Misses: " + std::to_string(stats.misses));
+              this->io.setOutputLine("Invalidations: " + std::to_string(stats.invalidations));
+
+              return SUCCESS;
+            });
+  }
+
+  void fgSetup()
+  {
+    $fg.setName("fg")
+        .setDescription("Brings a job to the foreground.")
+        .setAction(
+            [this](const std::string &target) -> int
+            {
+              Job *job = findJob(target);
+
+              if (job == nullptr or job->state == JOB_DONE)
+                return JOB_NOT_FOUND;
+
+              std::cout << job->command << "\n";
+              std::cout.flush();
+
+              bool terminal = shellGroup > 0 and job->group > 0;
+
+              if (terminal)
+                tcsetpgrp(STDIN_FILENO, job->group);
+
+              jobs.signal(*job, SIGCONT);
+              job->state = JOB_RUNNING;
+              jobs.waitForeground(*job);
+
+              if (terminal)
+                tcsetpgrp(STDIN_FILENO, shellGroup);
+
+              if (job->state == JOB_DONE)
+                jobs.remove(job->id);
+
+              return SUCCESS;
+            });
+  }
+
+  void bgSetup()
+  {
+    $bg.setName("bg")
+        .setDescription("Resumes a stopped job in the background.")
+        .setAction(
+            [this](const std::string &target) -> int
+            {
+              Job *job = findJob(target);
+
+              if (job == nullptr or job->state == JOB_DONE)
+                return JOB_NOT_FOUND;
+
+              if (jobs.signal(*job, SIGCONT) < 0)
+                return FAILURE;
+
+              job->state = JOB_RUNNING;
+              std::cout << "[" << job->id << "] " << job->command << " &\n";
+
+              return SUCCESS;
+            });
+  }
+
+  void waitSetup()
+  {
+    $wait.setName("wait")
+        .setDescription("Waits for a job, or for every job, to finish.")
+        .setAction(
+            [this](const std::string &target) -> int
+            {
+              if (target.empty())
+              {
+                jobs.wait();
+                return SUCCESS;
+              }
+
+              Job *job = findJob(target);
+
+              if (job == nullptr)
+                return JOB_NOT_FOUND;
+
+              jobs.wait(job->id);
+              return SUCCESS;
+            });
+  }
+
+  void timeSetup()
+  {
+    auto seconds = [](const struct timeval &after, const struct timeval &before)
+    {
+      return (after.tv_sec - before.tv_sec) + (after.tv_usec - before.tv_usec) / 1e6;
+    };
+
+    auto timeAction = [this, seconds](TokenSpan command, bool fromPipeline) -> int
+    {
+      if (command.empty())
+        return FAILURE;
+
+      HardwareCounters counters;
+      bool counting = counters.start();
+      long outerPeak = childPeak;
+      childPeak = 0;
+      UsageSample before = UsageSample::now();
+
+      if (std::any_of(command.begin(), command.end(), [](const Token &token)
+                      { return token.type == PIPE; }))
+        this->execPipeline(command);
+      else
+        this->execute(command, false, fromPipeline);
+
+      UsageSample after = UsageSample::now();
+      long peak = childPeak;
+      childPeak = outerPeak < 0 ? -1 : std::max(outerPeak, peak);
+      uint64_t totals[HARDWARE_COUNTER_COUNT];
+
+      if (counting)
+        counters.stop(totals);
+
+      std::cout.flush();
+      io.flush();
+
+      std::chrono::duration<double> wall = after.wall - before.wall;
+
+      std::ostringstream report;
+      report << std::fixed << std::setprecision(3) << std::left
+             << std::setw(18) << "real" << wall.count() << " s\n"
+             << std::setw(18) << "user" << seconds(after.self.ru_utime, before.self.ru_utime) + seconds(after.children.ru_utime, before.children.ru_utime) << " s\n"
+             << std::setw(18) << "sys" << seconds(after.self.ru_stime, before.self.ru_stime) + seconds(after.children.ru_stime, before.children.ru_stime) << " s\n"
+             << std::setw(18) << "max RSS";
+
+      // The peak of the processes the command ran; builtins run inside the shell, whose own peak
+      // covers its whole life and not just this command.
+      if (peak > 0)
+        report << peak << " KiB\n";
+      else
+        report << after.self.ru_maxrss << " KiB (shell lifetime peak)\n";
+
+      report << std::setw(18) << "context switches"
+             << (after.self.ru_nvcsw - before.self.ru_nvcsw) + (after.children.ru_nvcsw - before.children.ru_nvcsw) << " voluntary, "
+             << (after.self.ru_nivcsw - before.self.ru_nivcsw) + (after.children.ru_nivcsw - before.children.ru_nivcsw) << " involuntary\n"
+             << std::setw(18) << "page faults"
+             << (after.self.ru_minflt - before.self.ru_minflt) + (after.children.ru_minflt - before.children.ru_minflt) << " minor, "
+             << (after.self.ru_majflt - before.self.ru_majflt) + (after.children.ru_majflt - before.children.ru_majflt) << " major\n";
+
+      if (!counting)
+        report << std::setw(18) << "counters" << "unavailable (" << strerror(counters.getError()) << ")\n";
+      else
+      {
+        report << std::setw(18) << "cycles" << totals[COUNTER_CYCLES] << "\n"
+               << std::setw(18) << "instructions" << totals[COUNTER_INSTRUCTIONS];
+
+        if (totals[COUNTER_CYCLES] > 0)
+          report << std::setprecision(2) << " (" << static_cast<double>(totals[COUNTER_INSTRUCTIONS]) / totals[COUNTER_CYCLES] << " per cycle)";
+
+        report << "\n"
+               << std::setw(18) << "cache misses" << totals[COUNTER_CACHE_MISSES] << "\n";
+      }
+
+      std::cerr << report.str();
+      return SUCCESS;
+    };
+
+    $time.setName("time")
+        .setDescription("Runs a command line and reports the time and resources it used.")
+        .setAction(timeAction);
+  }
+  void historySetup()
+  {
+    $history.setName("history")
+        .setDescription("Lists or searches the command history.")
+        .setAction(
+            [this](const std::string &mode, const std::string &argument) -> int
+            {
+              if (!history.isOpen() and !history.open(expandHome(HISTORY_FILE)))
+                return OPEN_FILE_FAILURE;
+
+              auto print = [this](size_t entry)
+              {
+                std::ostringstream line;
+                line << std::setw(6) << entry + 1 << "  " << history.at(entry);
+                this->io.setOutputLine(line.str());
+              };
+
+              if (mode.empty())
+              {
+                size_t count = history.size(), first = 0;
+
+                if (!argument.empty())
+                {
+                  if (argument.find_first_not_of("0123456789") != std::string::npos)
+                    return FAILURE;
+
+                  first = count - std::min<size_t>(count, std::stoull(argument));
+                }
+
+                for (size_t entry = first; entry < count; entry++)
+                  print(entry);
+
+                return SUCCESS;
+              }
+
+              std::vector<size_t> matches;
+
+              if (mode == "-p")
+                history.searchPrefix(argument, HISTORY_NONE, HISTORY_SEARCH_LIMIT, matches);
+              else if (mode == "-f")
+                history.searchFuzzy(argument, HISTORY_NONE, HISTORY_SEARCH_LIMIT, matches);
+              else
+                return FAILURE;
+
+              for (size_t entry : matches)
+                print(entry);
+
+              return SUCCESS;
+            });
+  }
+
+
+  void echo(TokenSpan args)
+  {
+    std::string msg = "";
+
+    for (const std::string &word : this->getOperands(args))
+      msg += (msg.empty() ? "" : " ") + word;
+
+    io.setOutputLine(msg);
+
+    io.setOutputStream(STDOUT_STREAM);
+    io.setInputStream(STDIN_STREAM);
+  }
+
+  void help(TokenSpan args)
+  {
+    this->getOperands(args, false);
+
+    for (const auto *command : registry.list())
+    {
+      std::ostringstream line;
+      line << std::left << std::setw(12) << command->getName() << command->getDescription();
+      this->io.setOutputLine(line.str());
+    }
+
+    io.setOutputStream(STDOUT_STREAM);
+    this->finish();
+  }
+
+  void registrySetup()
+  {
+    auto exitAction = [this](TokenSpan, bool)
+    { this->$exit.execute(); };
+
+    registry.add("exit", $exit.getDescription(), exitAction);
+    registry.add("quit", $exit.getDescription(), exitAction);
+    registry.add("help", "Lists the available commands.", [this](TokenSpan args, bool)
+                 { this->help(args); });
+    registry.add("echo", $echo.getDescription(), [this](TokenSpan args, bool)
+                 { this->echo(args); });
+    registry.add("pwd", $pwd.getDescription(), [this](TokenSpan args, bool)
+                 { this->pwd(args); });
+    registry.add("hostname", $hostname.getDescription(), [this](TokenSpan args, bool)
+                 { this->hostname(args); });
+    registry.add("username", $username.getDescription(), [this](TokenSpan args, bool)
+                 { this->username(args); });
+    registry.add("touch", $touch.getDescription(), [this](TokenSpan args, bool)
+                 { this->touch(args); });
+    registry.add("mkdir", $mkdir.getDescription(), [this](TokenSpan args, bool)
+                 { this->mkDir(args); });
+    registry.add("rmfile", $rmfile.getDescription(), [this](TokenSpan args, bool)
+                 { this->rmfile(args); });
+    registry.add("ls", $ls.getDescription(), [this](TokenSpan args, bool)
+                 { this->ls(args); });
+    registry.add("rmdir", $rmdir.getDescription(), [this](TokenSpan args, bool)
+                 { this->rmDir(args); });
+    registry.add("mv", $mv.getDescription(), [this](TokenSpan args, bool)
+                 { this->mv(args); });
+    registry.add("cp", $cp.getDescription(), [this](TokenSpan args, bool)
+                 { this->cp(args); });
+    registry.add("cat", $cat.getDescription(), [this](TokenSpan args, bool)
+                 { this->cat(args); });
+    registry.add("cd", $cd.getDescription(), [this](TokenSpan args, bool)
+                 { this->cd(args); });
+    registry.add("grep", $grep.getDescription(), [this](TokenSpan args, bool fromPipeline)
+                 { this->grep(args, fromPipeline); });
+    registry.add("jobs", $jobs.getDescription(), [this](TokenSpan args, bool)
+                 { this->jobsList(args); });
+    registry.add("fg", $fg.getDescription(), [this](TokenSpan args, bool)
+                 { this->jobControlCommand($fg, args); });
+    registry.add("bg", $bg.getDescription(), [this](TokenSpan args, bool)
+                 { this->jobControlCommand($bg, args); });
+    registry.add("wait", $wait.getDescription(), [this](TokenSpan args, bool)
+                 { this->jobControlCommand($wait, args); });
+    registry.add("time", $time.getDescription(), [this](TokenSpan args, bool fromPipeline)
+                 { this->timeCommand(args, fromPipeline); });
+    registry.add("history", $history.getDescription(), [this](TokenSpan args, bool)
+                 { this->historyCommand(args); });
+    registry.add("dircache", $dircache.getDescription(), [this](TokenSpan args, bool)
+                 { this->dircacheList(args); });
+    registry.add("tail", $tail.getDescription(), [this](TokenSpan args, bool)
+                 { this->tail(args); });
+    registry.add("wc", $wc.getDescription(), [this](TokenSpan args, bool fromPipeline)
+                 { this->wc(args, fromPipeline); });
+  }
+
+  void cat(TokenSpan args)
+  {
+    std::vector<std::string> items = this->getOperands(args, false);
+
+    if (items.size() > 0)
+    {
+      switch (this->recordStatus(this->$cat.execute(trim(items[0]))))
       {
       case SUCCESS:
         break;
@@ -708,35 +1307,136 @@ private:
     }
 
     io.setOutputStream(STDOUT_STREAM);
-    puts("");
+    this->finish();
+  }
+
+  // Runs $grep over every file under `directory` on the pool. Each worker's own IO collects the
+  // matches of one file, which then go out whole, prefixed with the path, so the lines of
+  // different files never interleave.
+  void recursiveGrep(const Matcher &matcher, const std::string &directory, int &status)
+  {
+    IO *output = &io;
+    std::mutex outputMutex;
+    std::atomic<int> failure(SUCCESS);
+
+    auto searchFile = [&](const std::string &path)
+    {
+      std::ostringstream found;
+      int fileStatus = SUCCESS;
+
+      io.setOutputStream(found);
+      size_t matches = this->$grep.execute(path, true, matcher, fileStatus);
+      io.setOutputStream(STDOUT_STREAM);
+
+      if (fileStatus != SUCCESS)
+      {
+        int expected = SUCCESS;
+        failure.compare_exchange_strong(expected, fileStatus);
+      }
+
+      if (matches == 0)
+        return;
+
+      std::string text = found.str();
+      std::string_view lines(text);
+      std::lock_guard<std::mutex> lock(outputMutex);
+
+      while (!lines.empty())
+      {
+        size_t end = lines.find('\n');
+        const std::string_view pieces[] = {path, ":", lines.substr(0, end)};
+
+        for (std::string_view piece : pieces)
+          output->setOutput(piece);
+
+        output->setOutputLine("");
+        lines.remove_prefix(end == std::string_view::npos ? lines.size() : end + 1);
+      }
+    };
+
+    if (TreeWalker(workers()).walk(expandHome(directory), searchFile))
+      status = failure;
+    else
+      status = FILE_NOT_FOUND;
   }
 
-  void grep(std::string &args, bool fromPipeline = false)
+  // Appends the non-empty lines of `path` to `patterns`.
+  bool readPatterns(const std::string &path, std::vector<std::string> &patterns)
   {
-    std::vector<std::string> argsList = this->getItemsName(args);
-    int status;
+    int fd = open(expandHome(path).c_str(), O_RDONLY | O_CLOEXEC);
 
-    if (contains(args, OUTPUT_REDIRECTION_SYMBOL))
-      outputRedirection(args);
+    if (fd < 0)
+      return false;
 
-    if (fromPipeline)
+    LineReader reader;
+    reader.open(fd, true);
+
+    for (std::string_view line : reader)
+      if (!line.empty())
+        patterns.emplace_back(line);
+
+    return true;
+  }
+
+  // grep FILE PATTERN, grep -r PATTERN DIR, or PATTERN replaced by any number of `-e PATTERN`
+  // and `-f FILE` options; in a pipeline the FILE is the stage's input. With -E the patterns are
+  // extended regular expressions, and several of them are tried as one alternation.
+  void grep(TokenSpan args, bool fromPipeline = false)
+  {
+    std::vector<std::string> argsList = this->getOperands(args, false);
+    std::vector<std::string> patterns, operands;
+    bool recursive = false, multiple = false, extended = false;
+    int status = SUCCESS;
+
+    for (size_t i = 0; i < argsList.size(); i++)
     {
-      std::string content;
+      const std::string &arg = argsList[i];
 
-      while (!this->io.isEof())
-        content += this->io.getInputLine() + '\n';
+      if (arg == "-r")
+        recursive = true;
+      else if (arg == "-E")
+        extended = true;
+      else if ((arg == "-e" or arg == "-f") and i + 1 < argsList.size())
+      {
+        multiple = true;
 
-      this->$grep.execute(content, false, trim(argsList[0]), status);
+        if (arg == "-e")
+          patterns.push_back(argsList[++i]);
+        else if (!this->readPatterns(argsList[++i], patterns))
+          status = OPEN_FILE_FAILURE;
+      }
+      else
+        operands.push_back(trim(arg));
     }
-    else
+
+    size_t needed = (multiple ? 0 : 1) + (fromPipeline and !recursive ? 0 : 1);
+
+    if (status == SUCCESS and operands.size() < needed)
     {
-      if (argsList.size() > 1)
-        this->$grep.execute(trim(argsList[0]), true, trim(argsList[1]), status);
+      std::cerr << "Not enough parameters!\n";
+      this->recordStatus(FAILURE);
+    }
+    else if (status == SUCCESS)
+    {
+      std::string pattern = multiple ? "" : recursive or fromPipeline ? operands[0] : operands[1];
+
+      if (extended and multiple)
+        for (const std::string &alternative : patterns)
+          pattern += (pattern.empty() ? "(" : "|(") + alternative + ")";
+
+      Matcher matcher = extended ? Matcher::extended(pattern) : multiple ? Matcher(patterns) : Matcher(pattern);
+
+      if (!matcher.isValid())
+        status = INVALID_PATTERN;
+      else if (recursive)
+        this->recursiveGrep(matcher, operands.back(), status);
+      else if (fromPipeline)
+        this->$grep.execute("", false, matcher, status);
       else
-        std::cerr << "Not enough parameters!\n";
+        this->$grep.execute(operands[0], true, matcher, status);
     }
 
-    switch (status)
+    switch (this->recordStatus(status))
     {
     case SUCCESS:
       break;
@@ -745,6 +1445,14 @@ private:
       std::cout << "Failed to open file.\n";
       break;
 
+    case FILE_NOT_FOUND:
+      std::cout << "Directory not found.\n";
+      break;
+
+    case INVALID_PATTERN:
+      std::cout << "Invalid regular expression.\n";
+      break;
+
     case READ_FAILURE:
       std::cout << "Failed to read file.\n";
       break;
@@ -758,69 +1466,458 @@ private:
       break;
     }
 
-    io.setOutputStream(STDOUT_STREAM);
-    puts("");
-  }
+    io.setOutputStream(STDOUT_STREAM);
+    this->finish();
+  }
+
+  void pwd(TokenSpan args)
+  {
+    this->getOperands(args, false);
+    this->$pwd.execute();
+    this->finish();
+  }
+
+  void hostname(TokenSpan args)
+  {
+    this->getOperands(args, false);
+    this->io.setOutputLine(this->$hostname.execute());
+    this->finish();
+  }
+
+  void username(TokenSpan args)
+  {
+    this->getOperands(args, false);
+    this->io.setOutputLine(this->$username.execute());
+    this->finish();
+  }
+
+  void touch(TokenSpan args)
+  {
+    std::vector<std::string> filenames = this->getOperands(args, true, true);
+    std::vector<int> statuses;
+
+    this->$touch.execute(filenames, statuses);
+
+    for (int status : statuses)
+    {
+      switch (this->recordStatus(status))
+      {
+      case SUCCESS:
+        break;
+
+      case OPEN_FILE_FAILURE:
+        std::cout << "Failed to open file.\n";
+        break;
+
+      case CLOSE_FILE_FAILURE:
+        std::cout << "Failed to close file.\n";
+        break;
+
+      default:
+        std::cout << "Failed to execute the command.\n";
+        break;
+      }
+    }
+
+    io.setOutputStream(STDOUT_STREAM);
+    this->finish();
+  }
+
+  // The whole list is created first, possibly in parallel, and reported afterwards in its order.
+  void mkDir(TokenSpan args)
+  {
+    std::vector<std::string> folderNames = this->getOperands(args, true, false);
+    std::vector<int> statuses;
+
+    this->$mkdir.execute(folderNames, statuses);
+
+    for (int status : statuses)
+    {
+      switch (this->recordStatus(status))
+      {
+      case SUCCESS:
+        std::cout << "Folder created successfully.\n";
+        break;
+
+      case FAILURE:
+        std::cout << "Failed to create folder.\n";
+        break;
+
+      default:
+        std::cout << "Failed to execute the command.\n";
+        break;
+      }
+    }
+
+    this->finish();
+  }
+
+  void rmfile(TokenSpan args)
+  {
+    std::vector<std::string> filenames = this->getOperands(args, true, false);
+    std::vector<int> statuses;
+
+    this->$rmfile.execute(filenames, statuses);
+
+    for (int status : statuses)
+    {
+      switch (this->recordStatus(status))
+      {
+      case SUCCESS:
+        std::cout << "File removed successfully.\n";
+        break;
+
+      case FAILURE:
+        std::cout << "Failed to remove file.\n";
+        break;
+
+      default:
+        std::cout << "Failed to execute the command.\n";
+        break;
+      }
+    }
+
+    this->finish();
+  }
+
+  void ls(TokenSpan args)
+  {
+    std::string path = "./", mode = "";
+
+    for (const std::string &arg : this->getOperands(args))
+    {
+      if (arg.size() > 1 and arg[0] == '-')
+      {
+        if (arg.find_first_not_of("alU", 1) == std::string::npos)
+          mode += arg.substr(1);
+        else
+          std::cout << "ls: Argumento inválido: " << arg << "\n";
+      }
+      else
+        path = arg;
+    }
+
+    switch (this->recordStatus(this->$ls.execute(path, mode)))
+    {
+    case SUCCESS:
+      break;
+
+    case FILE_NOT_FOUND:
+      std::cout << "Directory not found.\n";
+      break;
+
+    default:
+      std::cout << "Failed to list the directory.\n";
+      break;
+    }
+
+    this->io.setOutputStream(STDOUT_STREAM);
+
+    this->finish();
+  }
+
+  void rmDir(TokenSpan args)
+  {
+    forEachOperand(args, true, false,
+                   [this](std::string_view filename)
+                   {
+                     switch (this->recordStatus(this->$rmdir.execute(std::string(filename))))
+                     {
+                     case SUCCESS:
+                       std::cout << "Folder removed successfully.\n";
+                       break;
+
+                     case FILE_NOT_FOUND:
+                       std::cout << "Folder not found.\n";
+                       break;
+
+                     case FAILURE:
+                       std::cout << "Failed to remove folder.\n";
+                       break;
+
+                     default:
+                       std::cout << "Failed to execute the command.\n";
+                       break;
+                     }
+                   });
+
+    this->finish();
+  }
+
+  void mv(TokenSpan args)
+  {
+    std::vector<std::string> paths = this->getOperands(args);
+
+    if (paths.size() > 1)
+    {
+      switch (this->recordStatus(this->$mv.execute(trim(paths[0]), trim(paths[1]))))
+      {
+      case SUCCESS:
+        std::cout << "Moved or renamed successfully.\n";
+        break;
+
+      case FILE_NOT_FOUND:
+        std::cerr << "File not found.\n";
+        break;
+
+      case SAME_SOURCE_N_TARGET:
+        std::cerr << "The target and the source are the same.\n";
+        break;
+
+      case FAILURE:
+        std::cerr << "Failed to move or rename.\n";
+        break;
+
+      default:
+        std::cerr << "Failed to execute the command.\n";
+        break;
+      }
+    }
+    else
+    {
+      std::cerr << "Invalid arguments!\n";
+      this->recordStatus(FAILURE);
+    }
+
+    this->finish();
+  }
+
+  // cp [-r] SOURCE TARGET
+  void cp(TokenSpan args)
+  {
+    std::vector<std::string> paths;
+    bool recursive = false;
+
+    for (const std::string &arg : this->getOperands(args))
+    {
+      if (arg == "-r" or arg == "-R")
+        recursive = true;
+      else
+        paths.push_back(trim(arg));
+    }
+
+    if (paths.size() > 1)
+    {
+      switch (this->recordStatus(this->$cp.execute(paths[0], paths[1], recursive)))
+      {
+      case SUCCESS:
+        std::cout << "Copied successfully.\n";
+        break;
+
+      case FILE_NOT_FOUND:
+        std::cerr << "File not found.\n";
+        break;
+
+      case SAME_SOURCE_N_TARGET:
+        std::cerr << "The target and the source are the same.\n";
+        break;
+
+      case IS_A_DIRECTORY:
+        std::cerr << "The source is a directory; use -r to copy it.\n";
+        break;
+
+      case FAILURE:
+        std::cerr << "Failed to copy.\n";
+        break;
+
+      default:
+        std::cerr << "Failed to execute the command.\n";
+        break;
+      }
+    }
+    else
+    {
+      std::cerr << "Invalid arguments!\n";
+      this->recordStatus(FAILURE);
+    }
+
+    this->finish();
+  }
+
+  void cd(TokenSpan args)
+  {
+    std::vector<std::string> path = this->getOperands(args);
+
+    if (path.size() > 0)
+    {
+      switch (this->recordStatus(this->$cd.execute(trim(path[0]))))
+      {
+      case SUCCESS:
+        break;
+
+      default:
+        std::cout << "Failed to execute the command.\n";
+        break;
+      }
+    }
+
+    this->finish();
+  }
+
+  void jobsList(TokenSpan args)
+  {
+    this->getOperands(args, false);
+    this->$jobs.execute();
+
+    io.setOutputStream(STDOUT_STREAM);
+    this->finish();
+  }
+
+  void tail(TokenSpan args)
+  {
+    std::vector<std::string> operands = this->getOperands(args, false);
+    std::string path, count = std::to_string(TAIL_DEFAULT_LINES);
+    bool follow = false, valid = true;
+
+    for (size_t i = 0; i < operands.size(); i++)
+    {
+      const std::string &arg = operands[i];
+
+      if (arg == "-f")
+        follow = true;
+      else if (arg == "-n" and i + 1 < operands.size())
+        count = operands[++i];
+      else if (arg.compare(0, 2, "-n") == 0 and arg.size() > 2)
+        count = arg.substr(2);
+      else if (path.empty() and arg[0] != '-')
+        path = arg;
+      else
+        valid = false;
+    }
+
+    valid = valid and !path.empty() and !count.empty() and count.find_first_not_of("0123456789") == std::string::npos;
+
+    switch (this->recordStatus(valid ? this->$tail.execute(path, std::stoull(count.substr(0, 18)), follow) : FAILURE))
+    {
+    case SUCCESS:
+      break;
+
+    case OPEN_FILE_FAILURE:
+      std::cout << "Failed to open file.\n";
+      break;
+
+    case IS_A_DIRECTORY:
+      std::cout << "Is a directory.\n";
+      break;
+
+    case READ_FAILURE:
+      std::cout << "Failed to read file.\n";
+      break;
+
+    case FAILURE:
+      std::cout << "Usage: tail [-n N] [-f] FILE\n";
+      break;
+
+    default:
+      std::cout << "Failed to execute the command.\n";
+      break;
+    }
+
+    io.setOutputStream(STDOUT_STREAM);
+    this->finish();
+  }
+
+  // Prints a row per file, in the order given, and a total when there are several; the columns
+  // are lines, words and bytes, as many as were asked for, right-aligned to a common width.
+  void wc(TokenSpan args, bool fromPipeline)
+  {
+    std::vector<std::string> operands = this->getOperands(args, false, true), paths;
+    std::string mode;
+    bool valid = true, redirected = false;
+
+    // `wc < FILE` counts FILE as the stream a pipeline would feed it, instead of reading operands from it.
+    for (size_t i = 0; i + 1 < args.size(); i++)
+      if (args[i].type == INPUT_REDIRECTION and args[i + 1].isWord())
+      {
+        this->inputRedirection(std::string(args[i + 1].text));
+        redirected = !io.isStdinStream();
+
+        if (!redirected)
+        {
+          this->recordStatus(OPEN_FILE_FAILURE);
+          io.setOutputStream(STDOUT_STREAM);
+          this->finish();
+          return;
+        }
+      }
+
+    for (const std::string &arg : operands)
+    {
+      if (arg.size() > 1 and arg[0] == '-')
+      {
+        valid = valid and arg.find_first_not_of("lwc", 1) == std::string::npos;
+        mode += arg.substr(1);
+      }
+      else
+        paths.push_back(arg);
+    }
+
+    if (!valid or (paths.empty() and !fromPipeline and !redirected))
+    {
+      std::cout << "Usage: wc [-l] [-w] [-c] FILE...\n";
+      this->recordStatus(FAILURE);
+      io.setOutputStream(STDOUT_STREAM);
 
-  void pwd(std::string &args)
-  {
-    if (contains(args, OUTPUT_REDIRECTION_SYMBOL))
-      outputRedirection(args);
-    this->$pwd.execute();
-    puts("");
-  }
+      if (redirected)
+        io.setInputStream(STDIN_STREAM);
 
-  void hostname(std::string &args)
-  {
-    if (contains(args, OUTPUT_REDIRECTION_SYMBOL))
-      outputRedirection(args);
-    this->io.setOutputLine(this->$hostname.execute());
-    puts("");
-  }
+      this->finish();
+      return;
+    }
 
-  void username(std::string &args)
-  {
-    if (contains(args, OUTPUT_REDIRECTION_SYMBOL))
-      outputRedirection(args);
-    this->io.setOutputLine(this->$username.execute());
-    puts("");
-  }
+    std::vector<Counts> counts;
+    std::vector<int> statuses;
+    Counts total = {0, 0, 0};
+    uint64_t widest = 0;
 
-  void touch(std::string &args)
-  {
-    std::istringstream iss;
+    mode = mode.empty() ? "lwc" : mode;
+    this->$wc.execute(paths, mode, counts, statuses);
+
+    for (size_t i = 0; i < counts.size(); i++)
+      if (statuses[i] == SUCCESS)
+      {
+        total.lines += counts[i].lines;
+        total.words += counts[i].words;
+        total.bytes += counts[i].bytes;
+      }
 
-    if (contains(args, INPUT_REDIRECTION_SYMBOL))
-      this->inputRedirection(args);
+    for (char column : mode)
+      widest = std::max(widest, column == 'l' ? total.lines : column == 'w' ? total.words : total.bytes);
 
-    if (contains(args, OUTPUT_REDIRECTION_SYMBOL))
-      this->outputRedirection(args);
+    size_t width = std::to_string(widest).size();
 
-    if (io.isStdinStream())
+    auto printRow = [this, &mode, width](const Counts &count, const std::string &name)
     {
-      iss = std::istringstream(args);
-      io.setInputStream(iss);
-    }
+      std::string row;
+
+      for (char column : {'l', 'w', 'c'})
+        if (contains(mode, column))
+        {
+          std::string number = std::to_string(column == 'l' ? count.lines : column == 'w' ? count.words : count.bytes);
+          row += (row.empty() ? "" : " ") + std::string(width - std::min(width, number.size()), ' ') + number;
+        }
 
-    std::string content = this->io.getAllInputLines();
+      this->io.setOutputLine(name.empty() ? row : row + " " + name);
+    };
 
-    for (const std::string &filename : this->getItemsName(content))
+    for (size_t i = 0; i < counts.size(); i++)
     {
-      switch (this->$touch.execute(trim(filename)))
+      switch (this->recordStatus(statuses[i]))
       {
       case SUCCESS:
+        printRow(counts[i], paths.empty() ? "" : paths[i]);
         break;
 
       case OPEN_FILE_FAILURE:
         std::cout << "Failed to open file.\n";
         break;
 
-      case READ_FAILURE:
-        std::cout << "Failed to read file.\n";
+      case IS_A_DIRECTORY:
+        std::cout << "Is a directory.\n";
         break;
 
-      case MEMORY_ALLOCATION_FAILURE:
-        std::cout << "Memory allocation failure.\n";
+      case READ_FAILURE:
+        std::cout << "Failed to read file.\n";
         break;
 
       default:
@@ -829,260 +1926,302 @@ private:
       }
     }
 
+    if (paths.size() > 1)
+      printRow(total, "total");
+
     io.setOutputStream(STDOUT_STREAM);
-    puts("");
+
+    if (redirected)
+      io.setInputStream(STDIN_STREAM);
+
+    this->finish();
   }
 
-  void mkDir(std::string &args)
+  void dircacheList(TokenSpan args)
   {
-    std::istringstream iss;
-
-    if (contains(args, INPUT_REDIRECTION_SYMBOL))
-      this->inputRedirection(args);
+    this->getOperands(args, false);
+    this->$dircache.execute();
 
-    if (io.isStdinStream())
-    {
-      iss = std::istringstream(args);
-      io.setInputStream(iss);
-    }
+    io.setOutputStream(STDOUT_STREAM);
+    this->finish();
+  }
 
-    std::string content = this->io.getAllInputLines();
+  void jobControlCommand(Command<int, const std::string &> &command, TokenSpan args)
+  {
+    std::vector<std::string> targets = this->getOperands(args, false, false);
 
-    for (const std::string &folderName : this->getItemsName(content))
-    {
-      switch (this->$mkdir.execute(trim(folderName)))
+    if (!jobControl)
+      std::cout << "No job control in this process.\n";
+    else
+      switch (command.execute(targets.empty() ? "" : targets[0]))
       {
       case SUCCESS:
-        std::cout << "Folder created successfully.\n";
         break;
 
-      case FAILURE:
-        std::cout << "Failed to create folder.\n";
+      case JOB_NOT_FOUND:
+        std::cout << "Job not found.\n";
         break;
 
       default:
         std::cout << "Failed to execute the command.\n";
         break;
       }
-    }
 
-    puts("");
+    this->finish();
   }
 
-  void rmfile(std::string &args)
+  // time COMMAND LINE: the whole line, pipes included, runs under the measurement.
+  void timeCommand(TokenSpan args, bool fromPipeline)
   {
-    std::istringstream iss;
+    switch (this->recordStatus(this->$time.execute(args, fromPipeline)))
+    {
+    case SUCCESS:
+      break;
 
-    if (contains(args, INPUT_REDIRECTION_SYMBOL))
-      this->inputRedirection(args);
+    case FAILURE:
+      std::cerr << "Not enough parameters!\n";
+      break;
 
-    if (io.isStdinStream())
-    {
-      iss = std::istringstream(args);
-      io.setInputStream(iss);
+    default:
+      std::cout << "Failed to execute the command.\n";
+      break;
     }
+  }
+
+  // history [N] | history -p PREFIX | history -f PATTERN: the searches list the newest distinct
+  // commands first; the words after the option make up one query.
+  void historyCommand(TokenSpan args)
+  {
+    std::vector<std::string> operands = this->getOperands(args, false);
+    std::string mode, argument;
 
-    std::string content = this->io.getAllInputLines();
+    if (!operands.empty() and operands[0].size() > 1 and operands[0][0] == '-')
+      mode = operands[0];
 
-    for (const std::string &filename : this->getItemsName(content))
+    for (size_t i = mode.empty() ? 0 : 1; i < operands.size(); i++)
+      argument += (argument.empty() ? "" : " ") + operands[i];
+
+    switch (this->recordStatus(this->$history.execute(mode, argument)))
     {
-      switch (this->$rmfile.execute(trim(filename)))
-      {
-      case SUCCESS:
-        std::cout << "File removed successfully.\n";
-        break;
+    case SUCCESS:
+      break;
 
-      case FAILURE:
-        std::cout << "Failed to remove file.\n";
-        break;
+    case OPEN_FILE_FAILURE:
+      std::cout << "Failed to open the history file.\n";
+      break;
 
-      default:
-        std::cout << "Failed to execute the command.\n";
-        break;
-      }
+    case FAILURE:
+      std::cout << "Usage: history [N] | history -p PREFIX | history -f PATTERN\n";
+      break;
+
+    default:
+      std::cout << "Failed to execute the command.\n";
+      break;
     }
 
-    puts("");
+    io.setOutputStream(STDOUT_STREAM);
+    this->finish();
   }
 
-  void ls(std::string &args)
+  void runExternal(std::string_view command, TokenSpan args)
   {
-    std::string path = "./", mode = "";
-    std::istringstream iss;
-
-    if (contains(args, INPUT_REDIRECTION_SYMBOL))
-      this->inputRedirection(args);
+    std::string path = pathIndex.lookup(command);
 
-    if (contains(args, OUTPUT_REDIRECTION_SYMBOL))
-      this->outputRedirection(args);
-
-    if (io.isStdinStream())
+    if (path.empty())
     {
-      iss = std::istringstream(args);
-      io.setInputStream(iss);
+      std::cerr << "Command not found: " << command << "\n\n";
+      lastStatus = EXIT_NOT_FOUND;
+      return;
     }
 
-    std::string content = this->io.getAllInputLines();
+    std::vector<std::string> argv = {std::string(command)};
+    int inputFd = -1, outputFd = -1;
 
-    if (content != "")
+    for (size_t i = 0; i < args.size(); i++)
     {
-      std::vector<std::string> args = this->getItemsName(content);
-      if (!args.empty())
+      const Token &token = args[i];
+
+      if (token.type == INPUT_REDIRECTION or token.type == OUTPUT_REDIRECTION)
       {
-        for (const std::string &arg : args)
+        if (i + 1 == args.size() or !args[i + 1].isWord())
+          continue;
+
+        std::string target = expandHome(std::string(args[++i].text));
+        int &fd = token.type == INPUT_REDIRECTION ? inputFd : outputFd;
+
+        if (fd >= 0)
+          close(fd);
+
+        fd = token.type == INPUT_REDIRECTION ? open(target.c_str(), O_RDONLY | O_CLOEXEC) : open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+        // A failed redirection leaves nothing to run: -1 would hand the child the shell's own stream.
+        if (fd < 0)
         {
-          if (std::regex_match(arg, std::regex("(\\s*)(-)([^\\s]+)(\\s*)")))
-          {
-            if (std::regex_match(arg, std::regex("(\\s*)(-a|-l|-la|-al)(\\s*)")))
-              mode = arg;
-            else
-              std::cout << "ls: Argumento inválido: " << arg << "\n";
-          }
-          else
-            path = arg;
+          std::cerr << (token.type == INPUT_REDIRECTION ? "Input file not found.\n\n" : "Output file not found.\n\n");
+
+          if (inputFd >= 0)
+            close(inputFd);
+          if (outputFd >= 0)
+            close(outputFd);
+
+          lastStatus = FAILURE;
+          return;
         }
       }
+      else if (token.isWord())
+        argv.emplace_back(token.text);
     }
 
-    this->$ls.execute(path, mode);
-    this->io.setOutputStream(STDOUT_STREAM);
+    std::cout.flush();
 
-    puts("");
-  }
+    bool terminal = jobControl and shellGroup > 0;
+    pid_t pid = spawnProcess(path, argv, inputFd, outputFd >= 0 ? outputFd : io.getOutputDescriptor(), terminal ? STDIN_FILENO : -1);
 
-  void rmDir(std::string &args)
-  {
-    std::istringstream iss;
+    if (inputFd >= 0)
+      close(inputFd);
 
-    if (contains(args, INPUT_REDIRECTION_SYMBOL))
-      this->inputRedirection(args);
+    if (outputFd >= 0)
+      close(outputFd);
 
-    if (io.isStdinStream())
+    if (pid < 0)
     {
-      iss = std::istringstream(args);
-      io.setInputStream(iss);
+      std::cerr << "Failed to execute: " << command << "\n\n";
+      lastStatus = EXIT_NOT_EXECUTABLE;
+      return;
     }
 
-    std::string content = this->io.getAllInputLines();
+    int status = 0;
+    bool stopped = reap(pid, &status, jobControl ? WUNTRACED : 0) == pid and WIFSTOPPED(status);
+    lastStatus = exitStatus(status);
 
-    for (const std::string &filename : this->getItemsName(content))
+    if (terminal)
+      tcsetpgrp(STDIN_FILENO, shellGroup);
+
+    if (stopped)
     {
-      switch (this->$rmdir.execute(trim(filename)))
-      {
-      case SUCCESS:
-        std::cout << "Folder removed successfully.\n";
-        break;
+      std::string text;
 
-      case FAILURE:
-        std::cout << "Failed to remove folder.\n";
-        break;
+      for (const std::string &arg : argv)
+        text += (text.empty() ? "" : " ") + arg;
 
-      default:
-        std::cout << "Failed to execute the command.\n";
-        break;
-      }
+      jobs.find(jobs.add(pid, terminal ? pid : 0, text, JOB_STOPPED))->changed = true;
     }
-
-    puts("");
   }
 
-  void mv(std::string &args)
+  // Stage threads share the shell, so only builtins that leave its state alone may run on them. A
+  // timed stage is judged by the command `time` runs: a program needs a real process and real
+  // descriptors, which a ring cannot give it.
+  bool runsOnThread(TokenSpan command)
   {
-    std::istringstream iss;
-
-    if (contains(args, INPUT_REDIRECTION_SYMBOL))
-      this->inputRedirection(args);
+    size_t word = 0;
 
-    if (contains(args, OUTPUT_REDIRECTION_SYMBOL))
-      this->outputRedirection(args);
+    while (word + 1 < command.size() and command[word].type == WORD and command[word].text == "time")
+      word++;
 
-    if (io.isStdinStream())
-    {
-      iss = std::istringstream(args);
-      io.setInputStream(iss);
-    }
-
-    std::string content = this->io.getAllInputLines();
+    return word < command.size() and registry.find(command[word].text) != nullptr and
+           std::find(STATEFUL_BUILTINS.begin(), STATEFUL_BUILTINS.end(), command[word].text) == STATEFUL_BUILTINS.end();
+  }
 
-    std::vector<std::string> paths = this->getItemsName(content);
+  void execPipeline(TokenSpan pipeline)
+  {
+    std::vector<TokenSpan> commands;
+    const Token *first = pipeline.begin();
 
-    if (paths.size() > 1)
+    for (const Token *token = pipeline.begin(); token != pipeline.end(); token++)
     {
-      switch (this->$mv.execute(trim(paths[0]), trim(paths[1])))
+      if (token->type == PIPE)
       {
-      case SUCCESS:
-        std::cout << "Moved or renamed successfully.\n";
-        break;
-
-      case FILE_NOT_FOUND:
-        std::cerr << "File not found.\n";
-        break;
+        commands.emplace_back(first, token);
+        first = token + 1;
+      }
+    }
 
-      case SAME_SOURCE_N_TARGET:
-        std::cerr << "The target and the source are the same.\n";
-        break;
+    commands.emplace_back(first, pipeline.end());
 
-      case FAILURE:
-        std::cerr << "Failed to move or rename.\n";
-        break;
+    bool builtinsOnly = std::all_of(commands.begin(), commands.end(), [this](TokenSpan command)
+                                    { return this->runsOnThread(command); });
 
-      default:
-        std::cerr << "Failed to execute the command.\n";
-        break;
-      }
-    }
+    if (builtinsOnly)
+      streamPipeline(commands);
     else
-      std::cerr << "Invalid arguments!\n";
-
-    puts("");
+      forkPipeline(commands);
   }
 
-  void cd(std::string &args)
+  // Runs every stage on its own thread; the stages hand fixed-size chunks to each other through
+  // bounded rings, so nothing is forked and the data is never held in full.
+  void streamPipeline(const std::vector<TokenSpan> &commands)
   {
-    std::istringstream iss;
+    std::vector<std::unique_ptr<RingBuffer>> rings;
+    std::vector<std::thread> stages;
+    int status = SUCCESS;
 
-    if (contains(args, INPUT_REDIRECTION_SYMBOL))
-      this->inputRedirection(args);
+    for (size_t i = 0; i + 1 < commands.size(); i++)
+      rings.push_back(std::make_unique<RingBuffer>());
 
-    if (contains(args, OUTPUT_REDIRECTION_SYMBOL))
-      this->outputRedirection(args);
+    // The stages may all reach for the pool at once; it is built here, before any of them runs.
+    workers();
+    std::cout.flush();
 
-    if (io.isStdinStream())
+    for (size_t i = 0; i < commands.size(); i++)
     {
-      iss = std::istringstream(args);
-      io.setInputStream(iss);
-    }
+      stages.emplace_back(
+          [this, &commands, &rings, &status, i]()
+          {
+            std::unique_ptr<RingReader> reader;
+            std::unique_ptr<RingWriter> writer;
+            std::istream input(nullptr);
+            std::ostream output(nullptr);
 
-    std::string content = this->io.getAllInputLines();
+            if (i > 0)
+            {
+              reader = std::make_unique<RingReader>(*rings[i - 1]);
+              input.rdbuf(reader.get());
+              io.setInputStream(input);
+            }
 
-    std::vector<std::string> path = this->getItemsName(content);
+            if (i + 1 < commands.size())
+            {
+              writer = std::make_unique<RingWriter>(*rings[i]);
+              output.rdbuf(writer.get());
+              io.setOutputStream(output);
+            }
 
-    if (path.size() > 0)
-    {
-      switch (this->$cd.execute(trim(path[0])))
-      {
-      case SUCCESS:
-        break;
+            this->execute(commands[i], false, true);
 
-      default:
-        std::cout << "Failed to execute the command.\n";
-        break;
-      }
+            // The line's status is the last stage's, as in other shells.
+            if (i + 1 == commands.size())
+              status = lastStatus;
+
+            io.setOutputStream(STDOUT_STREAM);
+            io.setInputStream(STDIN_STREAM);
+
+            if (writer)
+              writer->close();
+
+            if (reader)
+              reader->close();
+          });
     }
 
-    puts("");
+    for (std::thread &stage : stages)
+      stage.join();
+
+    lastStatus = status;
   }
 
-  void execPipeline(const std::string &pipeline)
+  void forkPipeline(const std::vector<TokenSpan> &commands)
   {
-    std::vector<std::string> commands = split(pipeline, '|');
+    std::cout.flush();
+    io.flush();
+
     int previousPipe[2];
     int currentPipe[2];
+    std::vector<pid_t> stages;
     pipe(previousPipe);
 
     for (size_t i = 0; i < commands.size(); i++)
     {
-      std::string command = trim(commands[i]);
+      TokenSpan command = commands[i];
 
       if (i < commands.size() - 1)
       {
@@ -1093,6 +2232,7 @@ private:
 
       if (pid == 0)
       {
+        jobControl = false;
         close(previousPipe[1]);
 
         if (i < commands.size() - 1)
@@ -1104,7 +2244,10 @@ private:
         if (i == 0)
           io.setInputStream(STDIN_STREAM);
         else
+        {
           dup2(previousPipe[0], STDIN_FILENO);
+          io.resetStdinStream();
+        }
 
         this->execute(command, false, true);
 
@@ -1113,7 +2256,7 @@ private:
         if (i < commands.size() - 1)
           close(currentPipe[1]);
 
-        exit(0);
+        exit(lastStatus);
       }
       else if (pid < 0)
       {
@@ -1122,6 +2265,7 @@ private:
       }
       else
       {
+        stages.push_back(pid);
         close(previousPipe[0]);
 
         if (i < commands.size() - 1)
@@ -1132,8 +2276,82 @@ private:
       }
     }
 
-    for (size_t i = 0; i < commands.size(); i++)
-      wait(NULL);
+    // Only the stages: a bare wait() could just as well reap a background job.
+    int status = 0;
+
+    for (pid_t stage : stages)
+      reap(stage, &status, 0);
+
+    lastStatus = stages.empty() ? SUCCESS : exitStatus(status);
+  }
+
+  void runLine(std::string_view line)
+  {
+    TokenSpan command = lexer.tokenize(line);
+    bool runInBackground = !command.empty() and command[command.size() - 1].type == BACKGROUND;
+
+    if (runInBackground)
+      command.last--;
+
+    // A leading `time` takes the whole pipeline, as in other shells, rather than its first stage.
+    bool timed = !command.empty() and command[0].type == WORD and command[0].text == "time";
+
+    if (!timed and std::any_of(command.begin(), command.end(), [](const Token &token)
+                               { return token.type == PIPE; }))
+    {
+      execPipeline(command);
+      return;
+    }
+
+    if (!runInBackground)
+    {
+      this->execute(command, runInBackground);
+      return;
+    }
+
+    std::cout.flush();
+    io.flush();
+
+    pid_t pid = fork();
+
+    if (pid == 0)
+    {
+      jobControl = false;
+      setpgid(0, 0);
+      signal(SIGTSTP, SIG_DFL);
+      signal(SIGTTOU, SIG_DFL);
+
+      this->execute(command, runInBackground);
+
+      exit(isRunning == false ? QUIT_COMMAND : SUCCESS);
+    }
+    else if (pid < 0)
+    {
+      std::cerr << "Erro ao criar o processo filho.\n";
+      lastStatus = FAILURE;
+    }
+    else
+    {
+      setpgid(pid, pid);
+      lastStatus = SUCCESS;
+
+      int id = jobs.add(pid, pid, trim(std::string(line.substr(0, line.find_last_of('&')))));
+
+      if (interactive)
+        std::cout << "[" << id << "] Process running in background! (PID: " << pid << ")\n\n";
+    }
+  }
+
+  void terminateJobs()
+  {
+    for (auto &[id, job] : jobs.list())
+    {
+      if (job.state == JOB_DONE)
+        continue;
+
+      this->$kill.execute(job.group > 0 ? -job.group : job.pid);
+      jobs.signal(job, SIGCONT);
+    }
   }
 
 public:
@@ -1152,132 +2370,191 @@ public:
     this->lsSetup();
     this->rmdirSetup();
     this->mvSetup();
+    this->cpSetup();
     this->catSetup();
     this->cdSetup();
     this->grepSetup();
     this->killSetup();
+    this->jobsSetup();
+    this->fgSetup();
+    this->bgSetup();
+    this->waitSetup();
+    this->timeSetup();
+    this->historySetup();
+    this->dircacheSetup();
+    this->tailSetup();
+    this->wcSetup();
+    this->registrySetup();
 
     return true;
   }
 
-  void execute(std::string &script, bool isRunningInBackgroung, bool fromPipeline = false)
-  {
-
-    std::istringstream iss(script);
-    std::string command, args;
-
-    iss >> command;
-    std::getline(iss, args);
-
-    if (command == "exit" or command == "quit")
-      isRunning = false;
-    else if (command == "echo")
-      this->echo(args);
-    else if (command == "pwd")
-      this->pwd(args);
-    else if (command == "hostname")
-      this->hostname(args);
-    else if (command == "username")
-      this->username(args);
-    else if (command == "touch")
-      this->touch(args);
-    else if (command == "mkdir")
-      this->mkDir(args);
-    else if (command == "rmfile")
-      this->rmfile(args);
-    else if (command == "ls")
-      this->ls(args);
-    else if (command == "rmdir")
-      this->rmDir(args);
-    else if (command == "mv")
-      this->mv(args);
-    else if (command == "cat")
-      cat(args);
-    else if (command == "cd")
-      this->cd(args);
-    else if (command == "grep")
-      grep(args, fromPipeline);
+  void execute(TokenSpan script, bool isRunningInBackgroung, bool fromPipeline = false)
+  {
+    if (script.empty())
+      return;
+
+    std::string_view command = script[0].text;
+    TokenSpan args(script.begin() + 1, script.end());
+
+    auto *builtin = registry.find(command);
+
+    if (builtin)
+    {
+      lastStatus = SUCCESS;
+      builtin->execute(args, fromPipeline);
+      io.flush();
+    }
     else
-      std::cerr << "Command not found: " << command << "\n\n";
+      this->runExternal(command, args);
   }
 
-  int init()
+  void registerCommand(const std::string &name, const std::string &description, const Builtin &action)
   {
-    bool runInBackground = false;
+    registry.add(name, description, action);
+  }
 
+  int init()
+  {
     std::cout << "Wellcome to Shell - Command Interpreter!!\n";
     std::cout << "Type 'help' to get a list of available commands.\n\n\n";
 
     isRunning = true;
+    hostnameFd = open("/proc/sys/kernel/hostname", O_RDONLY | O_CLOEXEC);
+    history.open(expandHome(HISTORY_FILE));
 
-    while (isRunning)
+    // On a terminal every job gets a process group of its own and the terminal is handed to the
+    // one in the foreground; the shell needs SIGTTOU ignored to take it back, and ignores SIGTSTP
+    // so that ^Z stops a foreground pipeline and not the shell that shares its group.
+    if (isatty(STDIN_FILENO))
     {
+      signal(SIGTSTP, SIG_IGN);
+      signal(SIGTTOU, SIG_IGN);
+      shellGroup = getpgrp();
+    }
 
-      this->io.setInputStream("stdin");
+    bool editing = isatty(STDIN_FILENO) and isatty(STDOUT_FILENO);
 
-      this->printPrompt();
+    while (isRunning)
+    {
 
-      std::string textFromPrompt, command;
-      textFromPrompt = this->io.getInputLine();
+      if (!io.isStdinStream())
+        this->io.setInputStream(STDIN_STREAM);
 
-      if (this->io.isEof())
+      if (!jobs.empty())
       {
-        puts("EOF");
-        break;
+        jobs.poll();
+        this->reportJobs();
       }
 
-      if (!io.isStdinStream())
-        std::cout << textFromPrompt << '\n';
-
-      runInBackground = std::regex_match(textFromPrompt, std::regex(".*\\s+&\\s*$"));
-      command = std::regex_replace(textFromPrompt, std::regex("\\s+&\\s*$"), "");
+      std::string textFromPrompt;
 
-      if (contains(command, '|'))
+      // A terminal gets the line editor; piped input, or lines already read ahead, the plain reader.
+      if (editing and !io.getStdinLines().hasLine())
       {
-        execPipeline(command);
-        continue;
+        std::cout.flush();
+
+        bool read = editor.readLine(currentPrompt(), textFromPrompt, [this]
+                                    { jobs.waitForInput(STDIN_FILENO, [this]
+                                                        {
+                                                          if (this->reportJobs(true))
+                                                          {
+                                                            std::cout.flush();
+                                                            editor.refresh();
+                                                          } }); });
+
+        if (!read)
+        {
+          puts("EOF");
+          break;
+        }
       }
-
-      pid_t pid;
-
-      if (runInBackground)
+      else
       {
-        pid = fork();
+        this->printPrompt();
 
-        if (pid == 0)
+        if (!io.getStdinLines().hasLine())
         {
-          std::cout << "\nProcess running in background! (PID: " << getpid() << ")\n";
+          std::cout.flush();
+          jobs.waitForInput(STDIN_FILENO, [this]
+                            {
+                              if (this->reportJobs(true))
+                                this->printPrompt();
 
-          this->execute(command, runInBackground);
+                              std::cout.flush(); });
+        }
 
-          std::cout << "\nProcess completed! (PID: " << getpid() << ")\n\n";
-          this->printPrompt();
+        textFromPrompt = this->io.getInputLine();
 
-          exit(isRunning == false ? QUIT_COMMAND : SUCCESS);
+        if (this->io.isEof())
+        {
+          puts("EOF");
+          break;
         }
-        else if (pid < 0)
-          std::cerr << "Erro ao criar o processo filho.\n";
-        else
-          childProcesses.push_back(pid);
       }
-      else
-      {
-        pid = getpid();
-        this->execute(command, runInBackground);
 
-        int status;
-        waitpid(pid, &status, 0);
+      // Only what is typed at a terminal is history; lines piped in are a script's, not the user's.
+      if (editing)
+        history.add(textFromPrompt);
 
-        if (WIFEXITED(status) && WEXITSTATUS(status) != SUCCESS)
-          isRunning = false;
-      }
+      this->runLine(textFromPrompt);
     }
 
-    for (pid_t pid : childProcesses)
-      this->$kill.execute(pid);
+    this->terminateJobs();
 
     return 0;
   }
+
+  // Runs a script back to back: no prompt, no echo, and the script is streamed in blocks through
+  // its own reader, so the commands keep the shell's stdin.
+  int run(LineReader &script)
+  {
+    std::string_view line;
+
+    interactive = false;
+    isRunning = true;
+
+    while (isRunning and script.next(line))
+    {
+      if (!io.isStdinStream())
+        this->io.setInputStream(STDIN_STREAM);
+
+      if (!jobs.empty())
+        jobs.poll();
+
+      this->runLine(line);
+    }
+
+    std::cout.flush();
+    this->terminateJobs();
+
+    return lastStatus;
+  }
+
+  int runFile(const std::string &path)
+  {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+    {
+      std::cerr << "Script not found: " << path << "\n";
+      return FILE_NOT_FOUND;
+    }
+
+    LineReader script;
+    script.open(fd, true);
+
+    return this->run(script);
+  }
+
+  int runCommand(const std::string &text)
+  {
+    std::istringstream source(text);
+    LineReader script;
+    script.open(source);
+
+    return this->run(script);
+  }
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,317 @@
+#ifndef __TAIL_HPP__
+#define __TAIL_HPP__
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#define TAIL_BLOCK_SIZE (64 * 1024)
+#define TAIL_DEFAULT_LINES 10
+#define TAIL_EVENT_BUFFER 4096
+#define TAIL_FILE_EVENTS (IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF)
+#define TAIL_DIRECTORY_EVENTS (IN_CREATE | IN_MOVED_TO | IN_ONLYDIR)
+
+// Finds where the last `count` lines of the first `size` bytes of `fd` begin, reading blocks
+// backwards from the end: only the tail is ever read, however long the file. A newline that ends
+// the file ends its last line and starts no other. Returns false on a read error.
+inline bool findLastLines(int fd, off_t size, size_t count, off_t &start)
+{
+  std::unique_ptr<char[]> buffer(new char[TAIL_BLOCK_SIZE]);
+  off_t end = size;
+
+  start = size;
+
+  if (count == 0 or size == 0)
+    return true;
+
+  while (end > 0)
+  {
+    off_t first = end > TAIL_BLOCK_SIZE ? end - TAIL_BLOCK_SIZE : 0;
+    ssize_t length = pread(fd, buffer.get(), end - first, first);
+
+    if (length < 0 and errno == EINTR)
+      continue;
+
+    if (length <= 0)
+      return length == 0;
+
+    // The file may have shrunk since it was measured; what was read is all there is.
+    length = std::min<off_t>(length, end - first);
+    size_t scanned = length;
+
+    if (end == size and buffer[length - 1] == '\n')
+      scanned--;
+
+    while (const void *found = memrchr(buffer.get(), '\n', scanned))
+    {
+      scanned = static_cast<const char *>(found) - buffer.get();
+
+      if (--count == 0)
+      {
+        start = first + scanned + 1;
+        return true;
+      }
+    }
+
+    end = first;
+  }
+
+  start = 0;
+  return true;
+}
+
+// Hands the bytes of `fd` from `offset` up to `end` to `output` a block at a time, and moves
+// `offset` past them. Returns false on a read error.
+template <typename Output>
+bool copyRange(int fd, off_t &offset, off_t end, Output &output)
+{
+  std::unique_ptr<char[]> buffer(new char[TAIL_BLOCK_SIZE]);
+
+  while (offset < end)
+  {
+    ssize_t length = pread(fd, buffer.get(), std::min<off_t>(end - offset, TAIL_BLOCK_SIZE), offset);
+
+    if (length < 0 and errno == EINTR)
+      continue;
+
+    if (length <= 0)
+      return length == 0;
+
+    output(std::string_view(buffer.get(), length));
+    offset += length;
+  }
+
+  return true;
+}
+
+// Turns ^C into a readable descriptor for as long as it lives, so that a builtin blocked in poll()
+// can stop instead of the signal ending the shell. Watches alive at once, such as two `tail -f`
+// stages of one pipeline, share the descriptor and the handler: the first installs them and the
+// last puts the previous handler back.
+class InterruptWatch
+{
+
+private:
+  static inline std::mutex mutex;
+  static inline size_t watchers = 0;
+  static inline int signalled = -1;
+  static inline struct sigaction previous;
+
+  static void onInterrupt(int)
+  {
+    uint64_t one = 1;
+    ssize_t written = write(signalled, &one, sizeof(one));
+    (void)written;
+  }
+
+public:
+  InterruptWatch()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (watchers++ > 0)
+      return;
+
+    struct sigaction action = {};
+
+    signalled = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    action.sa_handler = onInterrupt;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, &previous);
+  }
+
+  InterruptWatch(const InterruptWatch &) = delete;
+  InterruptWatch &operator=(const InterruptWatch &) = delete;
+
+  int descriptor() const
+  {
+    return signalled;
+  }
+
+  ~InterruptWatch()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (--watchers > 0)
+      return;
+
+    sigaction(SIGINT, &previous, nullptr);
+    close(signalled);
+    signalled = -1;
+  }
+};
+
+// Streams what is appended to a file for as long as nothing stops it, sleeping in poll() on an
+// inotify descriptor between writes. The file is watched for writes and for leaving its name; the
+// directory for a new file taking that name. When the name points to another inode, the old file is
+// read to its end and the new one from its start, the way logs are rotated. A file that shrinks
+// was truncated, and is read again from the start.
+class FileFollower
+{
+
+private:
+  std::string path;
+  std::string name;
+  int fd;
+  off_t position;
+  dev_t device;
+  ino_t inode;
+  int notify;
+  int fileWatch = -1;
+  int directoryWatch = -1;
+  int error = 0;
+
+  template <typename Output>
+  bool readAppended(Output &output)
+  {
+    struct stat st;
+
+    if (fstat(fd, &st) < 0)
+      return false;
+
+    if (st.st_size < position)
+      position = 0;
+
+    return copyRange(fd, position, st.st_size, output);
+  }
+
+  // Switches to the file that now has the name, if it is another one. Returns false on failure.
+  template <typename Output>
+  bool reopen(Output &output)
+  {
+    struct stat st;
+
+    if (stat(path.c_str(), &st) < 0 or (st.st_dev == device and st.st_ino == inode))
+      return true;
+
+    int next = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (next < 0)
+      return true;
+
+    if (!readAppended(output))
+    {
+      close(next);
+      return false;
+    }
+
+    inotify_rm_watch(notify, fileWatch);
+    close(fd);
+
+    fd = next;
+    position = 0;
+    device = st.st_dev;
+    inode = st.st_ino;
+    fileWatch = inotify_add_watch(notify, path.c_str(), TAIL_FILE_EVENTS);
+
+    return readAppended(output);
+  }
+
+public:
+  // Takes over `descriptor`, already read up to `offset`.
+  FileFollower(const std::string &file, int descriptor, off_t offset)
+      : path(file), fd(descriptor), position(offset), notify(inotify_init1(IN_CLOEXEC))
+  {
+    struct stat st;
+    size_t slash = path.find_last_of('/');
+
+    name = slash == std::string::npos ? path : path.substr(slash + 1);
+    fstat(fd, &st);
+    device = st.st_dev;
+    inode = st.st_ino;
+
+    if (notify < 0)
+    {
+      error = errno;
+      return;
+    }
+
+    fileWatch = inotify_add_watch(notify, path.c_str(), TAIL_FILE_EVENTS);
+    error = fileWatch < 0 ? errno : 0;
+    directoryWatch = inotify_add_watch(notify, slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash).c_str(),
+                                       TAIL_DIRECTORY_EVENTS);
+  }
+
+  FileFollower(const FileFollower &) = delete;
+  FileFollower &operator=(const FileFollower &) = delete;
+
+  ~FileFollower()
+  {
+    if (notify >= 0)
+      close(notify);
+
+    close(fd);
+  }
+
+  // Calls `output` with every block appended until `stop` becomes readable. Returns 0 or the errno
+  // that ended the watch.
+  template <typename Output>
+  int follow(int stop, Output output)
+  {
+    if (error != 0)
+      return error;
+
+    alignas(struct inotify_event) char buffer[TAIL_EVENT_BUFFER];
+    struct pollfd watched[] = {{notify, POLLIN, 0}, {stop, POLLIN, 0}};
+
+    if (!readAppended(output))
+      return errno;
+
+    while (true)
+    {
+      if (poll(watched, 2, -1) < 0)
+      {
+        if (errno == EINTR)
+          continue;
+
+        return errno;
+      }
+
+      if (watched[1].revents)
+        return 0;
+
+      ssize_t count = read(notify, buffer, sizeof(buffer));
+
+      if (count < 0)
+      {
+        if (errno == EINTR)
+          continue;
+
+        return errno;
+      }
+
+      bool written = false, renamed = false;
+
+      for (char *at = buffer; at < buffer + count;)
+      {
+        const struct inotify_event *event = reinterpret_cast<const struct inotify_event *>(at);
+        at += sizeof(struct inotify_event) + event->len;
+
+        if (event->wd == fileWatch)
+        {
+          written |= (event->mask & IN_MODIFY) != 0;
+          renamed |= (event->mask & (IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF)) != 0;
+        }
+        else if (event->wd == directoryWatch and event->len > 0 and name == event->name)
+          renamed = true;
+      }
+
+      if ((written and !readAppended(output)) or (renamed and !reopen(output)))
+        return errno;
+    }
+  }
+};
+
+#endif
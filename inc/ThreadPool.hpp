@@ -0,0 +1,203 @@
+#ifndef __THREAD_POOL_HPP__
+#define __THREAD_POOL_HPP__
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of workers, each with its own task deque. A worker takes its newest task first, which
+// keeps tree walks depth-first and cache-warm, and steals the oldest task of another worker
+// when it runs dry. Each thread that submits work waits only for its own tasks and the tasks they
+// submit in turn, so several callers can share the pool without waiting on each other.
+class ThreadPool
+{
+
+private:
+  struct Group
+  {
+    size_t pending;
+    std::mutex mutex;
+    std::condition_variable idle;
+
+    Group() : pending(0) {}
+  };
+
+  struct Task
+  {
+    std::function<void()> run;
+    Group *group;
+  };
+
+  struct Queue
+  {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::vector<std::thread> threads;
+  std::atomic<size_t> queued;
+  std::atomic<size_t> nextQueue;
+  std::mutex mutex;
+  std::condition_variable wake;
+  bool stopping;
+
+  static inline thread_local ThreadPool *currentPool = nullptr;
+  static inline thread_local size_t currentIndex = 0;
+  // The group of the task a worker is running, which the tasks it submits join; null elsewhere.
+  static inline thread_local Group *currentGroup = nullptr;
+  // The tasks submitted from a thread outside the pool.
+  static inline thread_local Group callerGroup;
+
+  static Group &ownGroup()
+  {
+    return currentGroup != nullptr ? *currentGroup : callerGroup;
+  }
+
+  bool pop(size_t self, Task &task)
+  {
+    {
+      Queue &own = *queues[self];
+      std::lock_guard<std::mutex> lock(own.mutex);
+
+      if (!own.tasks.empty())
+      {
+        task = std::move(own.tasks.back());
+        own.tasks.pop_back();
+        queued--;
+        return true;
+      }
+    }
+
+    for (size_t i = 1; i < queues.size(); i++)
+    {
+      Queue &victim = *queues[(self + i) % queues.size()];
+      std::lock_guard<std::mutex> lock(victim.mutex);
+
+      if (!victim.tasks.empty())
+      {
+        task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        queued--;
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  void run(size_t self)
+  {
+    currentPool = this;
+    currentIndex = self;
+
+    Task task;
+
+    while (true)
+    {
+      if (pop(self, task))
+      {
+        currentGroup = task.group;
+        task.run();
+        task.run = nullptr;
+        currentGroup = nullptr;
+
+        // Counted down under the lock, so a waiter cannot return and free the group before the
+        // notification is done with it.
+        std::lock_guard<std::mutex> lock(task.group->mutex);
+
+        if (--task.group->pending == 0)
+          task.group->idle.notify_all();
+
+        continue;
+      }
+
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [this]
+                { return stopping or queued > 0; });
+
+      if (stopping and queued == 0)
+        return;
+    }
+  }
+
+public:
+  explicit ThreadPool(size_t size = std::thread::hardware_concurrency()) : queued(0), nextQueue(0), stopping(false)
+  {
+    size = size == 0 ? 1 : size;
+
+    for (size_t i = 0; i < size; i++)
+      queues.push_back(std::make_unique<Queue>());
+
+    for (size_t i = 0; i < size; i++)
+      threads.emplace_back(&ThreadPool::run, this, i);
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  size_t size() const
+  {
+    return threads.size();
+  }
+
+  void submit(std::function<void()> task)
+  {
+    size_t index = currentPool == this ? currentIndex : nextQueue++ % queues.size();
+    Group &group = ownGroup();
+
+    {
+      std::lock_guard<std::mutex> lock(group.mutex);
+      group.pending++;
+    }
+
+    {
+      Queue &queue = *queues[index];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      queue.tasks.push_back({std::move(task), &group});
+      queued++;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    wake.notify_one();
+  }
+
+  // Waits until every task this thread submitted, including the ones submitted by those tasks, has
+  // finished. Tasks other threads submitted are not waited for.
+  bool wait(std::chrono::milliseconds timeout = std::chrono::milliseconds::max())
+  {
+    Group &group = ownGroup();
+    std::unique_lock<std::mutex> lock(group.mutex);
+
+    if (timeout == std::chrono::milliseconds::max())
+    {
+      group.idle.wait(lock, [&group]
+                      { return group.pending == 0; });
+      return true;
+    }
+
+    return group.idle.wait_for(lock, timeout, [&group]
+                               { return group.pending == 0; });
+  }
+
+  ~ThreadPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+
+    wake.notify_all();
+
+    for (std::thread &thread : threads)
+      thread.join();
+  }
+};
+
+#endif
@@ -0,0 +1,156 @@
+#ifndef __TIMING_HPP__
+#define __TIMING_HPP__
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+#include <dirent.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#define HARDWARE_COUNTER_COUNT 3
+
+enum HardwareCounter
+{
+  COUNTER_CYCLES,
+  COUNTER_INSTRUCTIONS,
+  COUNTER_CACHE_MISSES
+};
+
+// What getrusage reports at one instant, for the shell and for its children that have been waited
+// for; the difference of two samples is what happened in between.
+struct UsageSample
+{
+  std::chrono::steady_clock::time_point wall;
+  struct rusage self;
+  struct rusage children;
+
+  static UsageSample now()
+  {
+    UsageSample sample;
+    sample.wall = std::chrono::steady_clock::now();
+    getrusage(RUSAGE_SELF, &sample.self);
+    getrusage(RUSAGE_CHILDREN, &sample.children);
+    return sample;
+  }
+};
+
+// Cycles, instructions and cache misses in user space, counted with perf_event_open on every
+// thread of the shell. The counters are inherited, so threads and children started while they run
+// are counted too, and a child's counts join its parent's when it exits.
+class HardwareCounters
+{
+
+private:
+  std::vector<int> descriptors;
+  int error = 0;
+
+  static int openCounter(uint64_t event, pid_t thread)
+  {
+    struct perf_event_attr attributes = {};
+    attributes.size = sizeof(attributes);
+    attributes.type = PERF_TYPE_HARDWARE;
+    attributes.config = event;
+    attributes.disabled = 1;
+    attributes.inherit = 1;
+    attributes.exclude_kernel = 1;
+    attributes.exclude_hv = 1;
+    attributes.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    return syscall(SYS_perf_event_open, &attributes, thread, -1, -1, PERF_FLAG_FD_CLOEXEC);
+  }
+
+  void closeAll()
+  {
+    for (int fd : descriptors)
+      close(fd);
+
+    descriptors.clear();
+  }
+
+public:
+  HardwareCounters() = default;
+  HardwareCounters(const HardwareCounters &) = delete;
+  HardwareCounters &operator=(const HardwareCounters &) = delete;
+
+  // Returns false, leaving the reason in getError(), when the kernel or the hardware refuses.
+  bool start()
+  {
+    static const uint64_t events[HARDWARE_COUNTER_COUNT] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                                            PERF_COUNT_HW_CACHE_MISSES};
+    DIR *tasks = opendir("/proc/self/task");
+
+    if (tasks == nullptr)
+    {
+      error = errno;
+      return false;
+    }
+
+    while (struct dirent *task = readdir(tasks))
+    {
+      if (task->d_name[0] == '.')
+        continue;
+
+      for (uint64_t event : events)
+      {
+        int fd = openCounter(event, atoi(task->d_name));
+
+        if (fd < 0)
+        {
+          error = errno;
+          closedir(tasks);
+          closeAll();
+          return false;
+        }
+
+        descriptors.push_back(fd);
+      }
+    }
+
+    closedir(tasks);
+
+    for (int fd : descriptors)
+      ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+
+    return true;
+  }
+
+  // Sums every thread's counters into `totals`, scaling those the kernel had to multiplex.
+  void stop(uint64_t totals[HARDWARE_COUNTER_COUNT])
+  {
+    for (int fd : descriptors)
+      ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+
+    for (int i = 0; i < HARDWARE_COUNTER_COUNT; i++)
+      totals[i] = 0;
+
+    for (size_t i = 0; i < descriptors.size(); i++)
+    {
+      uint64_t values[3];
+
+      if (read(descriptors[i], values, sizeof(values)) != sizeof(values) or values[2] == 0)
+        continue;
+
+      totals[i % HARDWARE_COUNTER_COUNT] += values[2] == values[1] ? values[0] : static_cast<uint64_t>(static_cast<double>(values[0]) * values[1] / values[2]);
+    }
+
+    closeAll();
+  }
+
+  int getError() const
+  {
+    return error;
+  }
+
+  ~HardwareCounters()
+  {
+    closeAll();
+  }
+};
+
+#endif
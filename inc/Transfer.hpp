@@ -0,0 +1,235 @@
+#ifndef __TRANSFER_HPP__
+#define __TRANSFER_HPP__
+
+#include <string_view>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+
+#define TRANSFER_CHUNK_SIZE (1 << 30)
+#define SPLICE_CHUNK_SIZE (1 << 20)
+#define COPY_BUFFER_SIZE (1 << 17)
+
+class MappedFile
+{
+
+private:
+  void *address;
+  size_t length;
+
+public:
+  MappedFile() : address(MAP_FAILED), length(0) {}
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  bool map(int fd, size_t size)
+  {
+    length = size;
+
+    if (length == 0)
+      return true;
+
+    address = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (address == MAP_FAILED)
+      return false;
+
+    madvise(address, length, MADV_SEQUENTIAL);
+    return true;
+  }
+
+  std::string_view data() const
+  {
+    if (address == MAP_FAILED)
+      return std::string_view();
+
+    return std::string_view(static_cast<const char *>(address), length);
+  }
+
+  ~MappedFile()
+  {
+    if (address != MAP_FAILED)
+      munmap(address, length);
+  }
+};
+
+inline bool writeAll(int fd, const char *data, size_t size)
+{
+  while (size > 0)
+  {
+    ssize_t nwritten = write(fd, data, size);
+
+    if (nwritten < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+
+    data += nwritten;
+    size -= nwritten;
+  }
+
+  return true;
+}
+
+// Hands everything `in` yields to `output` a buffer at a time, for the sources whose size says
+// nothing of their contents: pipes, devices and the pseudo-files of /proc and /sys.
+template <typename Output>
+bool readAll(int in, Output output)
+{
+  static thread_local char buffer[COPY_BUFFER_SIZE];
+
+  while (true)
+  {
+    ssize_t nread = read(in, buffer, sizeof(buffer));
+
+    if (nread == 0)
+      return true;
+
+    if (nread < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+
+    output(std::string_view(buffer, nread));
+  }
+}
+
+// Copies `size` bytes from the start of `in` to `out` without passing them through userspace:
+// splice when the target is a pipe, sendfile otherwise. Targets the kernel refuses (terminals,
+// O_APPEND files on older kernels) are served from a sequential mapping of the source instead.
+inline bool transferFile(int in, int out, off_t size)
+{
+  struct stat outSb;
+  off_t offset = 0;
+
+  if (fstat(out, &outSb) == 0 && S_ISFIFO(outSb.st_mode))
+  {
+    while (offset < size)
+    {
+      ssize_t nspliced = splice(in, &offset, out, nullptr, SPLICE_CHUNK_SIZE, SPLICE_F_MOVE | SPLICE_F_MORE);
+
+      if (nspliced == 0)
+        return true;
+
+      if (nspliced < 0)
+      {
+        if (errno == EINTR)
+          continue;
+        if (offset == 0 && (errno == EINVAL || errno == ENOSYS))
+          break;
+        return false;
+      }
+    }
+
+    if (offset != 0)
+      return true;
+  }
+  else
+  {
+    while (offset < size)
+    {
+      ssize_t nsent = sendfile(out, in, &offset, TRANSFER_CHUNK_SIZE);
+
+      if (nsent == 0)
+        return true;
+
+      if (nsent < 0)
+      {
+        if (errno == EINTR)
+          continue;
+        if (offset == 0 && (errno == EINVAL || errno == ENOSYS))
+          break;
+        return false;
+      }
+    }
+
+    if (offset != 0 || size == 0)
+      return true;
+  }
+
+  MappedFile mapping;
+
+  if (!mapping.map(in, size))
+    return false;
+
+  return writeAll(out, mapping.data().data(), mapping.data().size());
+}
+
+// Whether a failed copy step only means the filesystems do not support it, so the next one may work.
+inline bool isUnsupported(int error)
+{
+  return error == EXDEV or error == EINVAL or error == ENOSYS or error == EOPNOTSUPP or error == ENOTTY or error == EBADF;
+}
+
+// Copies the whole of `in` into the empty file `out`, both freshly opened, by the cheapest means
+// the filesystems allow: a reflink sharing the source's extents, copy_file_range inside the kernel,
+// sendfile, and at last a plain buffer loop. Each step goes on from where the previous one gave up.
+inline bool copyFileContents(int in, int out)
+{
+  if (ioctl(out, FICLONE, in) == 0)
+    return true;
+
+  while (true)
+  {
+    ssize_t ncopied = copy_file_range(in, nullptr, out, nullptr, TRANSFER_CHUNK_SIZE, 0);
+
+    if (ncopied == 0)
+      return true;
+
+    if (ncopied > 0 or errno == EINTR)
+      continue;
+
+    if (!isUnsupported(errno))
+      return false;
+
+    break;
+  }
+
+  while (true)
+  {
+    ssize_t nsent = sendfile(out, in, nullptr, TRANSFER_CHUNK_SIZE);
+
+    if (nsent == 0)
+      return true;
+
+    if (nsent > 0 or errno == EINTR)
+      continue;
+
+    if (!isUnsupported(errno))
+      return false;
+
+    break;
+  }
+
+  static thread_local char buffer[COPY_BUFFER_SIZE];
+
+  while (true)
+  {
+    ssize_t nread = read(in, buffer, sizeof(buffer));
+
+    if (nread == 0)
+      return true;
+
+    if (nread < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+
+    if (!writeAll(out, buffer, nread))
+      return false;
+  }
+}
+
+#endif
@@ -0,0 +1,220 @@
+#ifndef __URING_HPP__
+#define __URING_HPP__
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+// A minimal io_uring on the raw system calls: one submission ring, one completion ring and the
+// shared entry array, mapped once. Not thread-safe; each batch owns its ring.
+class Uring
+{
+
+private:
+  int fd;
+  void *submissionRing;
+  void *completionRing;
+  size_t submissionRingSize;
+  size_t completionRingSize;
+  struct io_uring_sqe *entries;
+  size_t entriesSize;
+  unsigned *submissionHead;
+  unsigned *submissionTail;
+  unsigned *submissionArray;
+  unsigned submissionMask;
+  unsigned submissionCount;
+  unsigned *completionHead;
+  unsigned *completionTail;
+  struct io_uring_cqe *completions;
+  unsigned completionMask;
+  unsigned completionCount;
+  unsigned tail;
+  unsigned unsubmitted;
+
+  template <typename T>
+  static T *at(void *base, uint32_t offset)
+  {
+    return reinterpret_cast<T *>(static_cast<char *>(base) + offset);
+  }
+
+public:
+  explicit Uring(unsigned size) : fd(-1), submissionRing(MAP_FAILED), completionRing(MAP_FAILED), entries(nullptr), tail(0), unsubmitted(0)
+  {
+    struct io_uring_params params = {};
+    params.flags = IORING_SETUP_SUBMIT_ALL;
+
+    fd = syscall(SYS_io_uring_setup, size, &params);
+
+    if (fd < 0 and errno == EINVAL)
+    {
+      params = {};
+      fd = syscall(SYS_io_uring_setup, size, &params);
+    }
+
+    if (fd < 0)
+      return;
+
+    submissionRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    completionRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+      submissionRingSize = completionRingSize = std::max(submissionRingSize, completionRingSize);
+
+    submissionRing = mmap(nullptr, submissionRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    completionRing = params.features & IORING_FEAT_SINGLE_MMAP
+                         ? submissionRing
+                         : mmap(nullptr, completionRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+
+    entriesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes = mmap(nullptr, entriesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+
+    if (submissionRing == MAP_FAILED or completionRing == MAP_FAILED or sqes == MAP_FAILED)
+    {
+      if (sqes != MAP_FAILED)
+        munmap(sqes, entriesSize);
+      close(fd);
+      fd = -1;
+      return;
+    }
+
+    entries = static_cast<struct io_uring_sqe *>(sqes);
+    submissionHead = at<unsigned>(submissionRing, params.sq_off.head);
+    submissionTail = at<unsigned>(submissionRing, params.sq_off.tail);
+    submissionArray = at<unsigned>(submissionRing, params.sq_off.array);
+    submissionMask = *at<unsigned>(submissionRing, params.sq_off.ring_mask);
+    submissionCount = params.sq_entries;
+    completionHead = at<unsigned>(completionRing, params.cq_off.head);
+    completionTail = at<unsigned>(completionRing, params.cq_off.tail);
+    completions = at<struct io_uring_cqe>(completionRing, params.cq_off.cqes);
+    completionMask = *at<unsigned>(completionRing, params.cq_off.ring_mask);
+    completionCount = params.cq_entries;
+    tail = *submissionTail;
+  }
+
+  Uring(const Uring &) = delete;
+  Uring &operator=(const Uring &) = delete;
+
+  bool isReady() const
+  {
+    return fd >= 0;
+  }
+
+  // Whether the running kernel implements `opcode`.
+  bool supports(uint8_t opcode) const
+  {
+    const unsigned count = 256;
+    char buffer[sizeof(struct io_uring_probe) + count * sizeof(struct io_uring_probe_op)] = {};
+    struct io_uring_probe *probe = reinterpret_cast<struct io_uring_probe *>(buffer);
+
+    if (syscall(SYS_io_uring_register, fd, IORING_REGISTER_PROBE, probe, count) < 0)
+      return false;
+
+    return opcode <= probe->last_op and (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED);
+  }
+
+  // Caps the kernel threads that run requests which cannot complete without blocking; bounded and
+  // unbounded work alike. Older kernels ignore it.
+  void limitWorkers(unsigned count)
+  {
+    unsigned limits[2] = {count, count};
+    syscall(SYS_io_uring_register, fd, IORING_REGISTER_IOWQ_MAX_WORKERS, limits, 2);
+  }
+
+  // How many requests may be in flight without the completion ring overflowing.
+  unsigned capacity() const
+  {
+    return completionCount;
+  }
+
+  // A cleared submission entry, or nullptr when the ring is full until the next submit().
+  struct io_uring_sqe *next()
+  {
+    if (tail - __atomic_load_n(submissionHead, __ATOMIC_ACQUIRE) == submissionCount)
+      return nullptr;
+
+    unsigned index = tail & submissionMask;
+    struct io_uring_sqe *entry = &entries[index];
+
+    memset(entry, 0, sizeof(*entry));
+    submissionArray[index] = index;
+    tail++;
+    unsubmitted++;
+
+    return entry;
+  }
+
+  // Hands the prepared entries to the kernel and waits for at least `wait` completions.
+  // Returns 0 or the errno of io_uring_enter.
+  int submit(unsigned wait)
+  {
+    __atomic_store_n(submissionTail, tail, __ATOMIC_RELEASE);
+
+    while (true)
+    {
+      int submitted = syscall(SYS_io_uring_enter, fd, unsubmitted, wait, IORING_ENTER_GETEVENTS, nullptr, 0);
+
+      if (submitted >= 0)
+      {
+        unsubmitted -= submitted;
+        return 0;
+      }
+
+      if (errno != EINTR)
+        return errno;
+    }
+  }
+
+  // Takes back the prepared entries the kernel has not consumed, calling `onEntry(entry)` for each;
+  // they are never submitted. Only safe between calls to submit().
+  template <typename Callback>
+  void withdraw(Callback onEntry)
+  {
+    unsigned head = __atomic_load_n(submissionHead, __ATOMIC_ACQUIRE);
+
+    for (unsigned i = head; i != tail; i++)
+      onEntry(entries[submissionArray[i & submissionMask]]);
+
+    tail = head;
+    unsubmitted = 0;
+    __atomic_store_n(submissionTail, tail, __ATOMIC_RELEASE);
+  }
+
+  // Calls `onCompletion(userData, result)` for every completion posted so far.
+  template <typename Callback>
+  unsigned reap(Callback onCompletion)
+  {
+    unsigned head = *completionHead;
+    unsigned last = __atomic_load_n(completionTail, __ATOMIC_ACQUIRE);
+    unsigned count = last - head;
+
+    for (; head != last; head++)
+    {
+      const struct io_uring_cqe &completion = completions[head & completionMask];
+      onCompletion(completion.user_data, completion.res);
+    }
+
+    __atomic_store_n(completionHead, head, __ATOMIC_RELEASE);
+    return count;
+  }
+
+  ~Uring()
+  {
+    if (fd < 0)
+      return;
+
+    munmap(entries, entriesSize);
+
+    if (completionRing != submissionRing)
+      munmap(completionRing, completionRingSize);
+
+    munmap(submissionRing, submissionRingSize);
+    close(fd);
+  }
+};
+
+#endif
@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <string>
+#include <cstdlib>
 
 inline std::vector<std::string> split(const std::string& str, const char& character)
 {
@@ -38,4 +39,17 @@ inline std::string trim(const std::string & str) {
     return str.substr(begin, len);
 }
 
+inline std::string expandHome(const std::string &path)
+{
+  if (path.empty() || path[0] != '~')
+    return path;
+
+  const char *home = std::getenv("HOME");
+
+  if (!home)
+    return path;
+
+  return home + path.substr(1);
+}
+
 #endif
\ No newline at end of file
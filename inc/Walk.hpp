@@ -0,0 +1,82 @@
+#ifndef __WALK_HPP__
+#define __WALK_HPP__
+
+#include <functional>
+#include <string>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "Listing.hpp"
+#include "ThreadPool.hpp"
+
+// Visits every regular file under a directory on the pool: each directory is read by one task and
+// each file it holds is handed to `onFile` in a task of its own. Symbolic links are not followed.
+class TreeWalker
+{
+
+private:
+  ThreadPool &pool;
+  std::function<void(const std::string &)> onFile;
+
+  void scan(const std::string &path)
+  {
+    // Tasks never nest, so one getdents64 buffer per worker is enough.
+    static thread_local DirectoryStream stream;
+
+    if (!stream.open(path))
+      return;
+
+    const char *name;
+    unsigned char type;
+
+    while (stream.fill())
+    {
+      while (stream.next(name, type))
+      {
+        std::string child = path.back() == '/' ? path + name : path + '/' + name;
+
+        if (type == DT_UNKNOWN)
+        {
+          struct stat st;
+
+          if (fstatat(stream.descriptor(), name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+            continue;
+
+          type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+
+        if (type == DT_DIR)
+          pool.submit([this, child]
+                      { scan(child); });
+        else if (type == DT_REG)
+          pool.submit([this, child]
+                      { onFile(child); });
+      }
+    }
+
+    stream.close();
+  }
+
+public:
+  explicit TreeWalker(ThreadPool &p) : pool(p) {}
+
+  // Returns once every file has been visited, or false when `root` is not a directory; `onFile`
+  // runs on the pool's threads.
+  bool walk(const std::string &root, const std::function<void(const std::string &)> &callback)
+  {
+    struct stat st;
+
+    if (stat(root.c_str(), &st) < 0 or !S_ISDIR(st.st_mode))
+      return false;
+
+    onFile = callback;
+
+    pool.submit([this, root]
+                { scan(root); });
+    pool.wait();
+
+    return true;
+  }
+};
+
+#endif
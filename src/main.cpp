@@ -1,9 +1,23 @@
 #include <iostream>
+#include <cstring>
 #include "Shell.hpp"
 
-int main () {
+int main (int argc, char *argv[]) {
   Shell shell;
   shell.setup();
+
+  if ( argc > 1 && strcmp(argv[1], "-c") == 0 ) {
+    if ( argc < 3 ) {
+      std::cerr << "Usage: " << argv[0] << " [-c COMMAND | SCRIPT]\n";
+      return 2;
+    }
+
+    return shell.runCommand(argv[2]);
+  }
+
+  if ( argc > 1 )
+    return shell.runFile(argv[1]);
+
   if ( shell.init() == SUCCESS ) 
     std::cout << "\nShell finished successfully.\n";
 	return 0;